@@ -5,6 +5,11 @@
 #ifndef R_CRLF_COUNTER_H
 #define R_CRLF_COUNTER_H
 #include "strbuf.h"
+#include "rarray.h"
+
+#ifndef CRLF_PACKED_BLOCK
+#	define CRLF_PACKED_BLOCK 64
+#endif
 
 struct lncolumn {
 	int line;
@@ -12,12 +17,33 @@ struct lncolumn {
 };
 
 /*
- * This module is often used with lexer to save the position of '\n'
+ * This module is often used with lexer to save the position of '\n',
+ * the chunks are merged into one flat array by the first crlf_get() after crlf_add()
+ *
+ * In lazy mode(crlf_lazy) nothing is recorded during lexing,
+ * the index will be built from the source by the first crlf_get()
  */
 struct crlf_counter {
 	int csize;
 	int length;
 	void *chunks;
+	// lazy mode
+	const void *source;
+	int srclen;   // in characters
+	int charsize; // 1 or 2(UCS2)
+	int pending;  // the index has not been built from source
+};
+
+/*
+ * Delta-compressed variant for very large files, the positions must be added in ascending order.
+ * The deltas are saved as varint(roughly 1-2 bytes per line),
+ * and every CRLF_PACKED_BLOCK positions have an entry in the sparse skip index
+ */
+struct crlf_packed {
+	int length; // the number of positions added
+	int last;   // the last position added
+	struct rarray bytes; // varint deltas
+	struct rarray skips; // skip index
 };
 
 C_FUNCTION_BEGIN
@@ -26,7 +52,20 @@ void crlf_init(struct crlf_counter *crlf);
 void crlf_release(struct crlf_counter *crlf);
 
 void crlf_add(struct crlf_counter *crlf, int pos);
+void crlf_lazy(struct crlf_counter *crlf, const void *source, int len, int charsize);
 struct lncolumn crlf_get(struct crlf_counter *crlf, int pos);
 
+/*
+ * Resolves "n" positions(sorted or not) with one merge-walk over the line index,
+ * columns are in code points if the lazy source is UTF-8(charsize == 1)
+ */
+void crlf_get_many(struct crlf_counter *crlf, const int positions[], int n, struct lncolumn out[]);
+
+void crlf_packed_init(struct crlf_packed *crlf);
+void crlf_packed_release(struct crlf_packed *crlf);
+
+void crlf_packed_add(struct crlf_packed *crlf, int pos);
+struct lncolumn crlf_packed_get(struct crlf_packed *crlf, int pos);
+
 C_FUNCTION_END
 #endif
@@ -17,14 +17,59 @@ struct rarray {
 	int size; // sizeof(element)
 };
 
+// the header before "rarray.base"
+struct rarray_head {
+	int len;
+	int cap;
+	int flags;
+	int __pad;
+	char data[0];
+};
+
+#define RARRAY_INLINE  1 // the head isn't allocated by ra_realloc
+
+/*
+ * Small-buffer-optimized rarray, the first "n" elements are kept inline,
+ * and it spills to heap only on overflow. Use "&sbo.arr" with rarray_xxx(),
+ * NOTE: alignof(type) must be <= 8
+ */
+#define RARRAY_SBO(type, n) \
+struct { \
+	struct rarray arr; \
+	struct rarray_head head; \
+	type data[n]; \
+}
+
+#define rarray_sbo_init(sbo) \
+	rarray_init_inline(&(sbo)->arr, sizeof((sbo)->data[0]), &(sbo)->head, (int)ARRAYSIZE((sbo)->data))
+
+#define rarray_head_of(base)              (container_of(((void *)(base)), struct rarray_head, data))
+
 #define rarray_fast_get(prar, type, i)    (((type *)(prar)->base) + (i))
 #define rarray_fast_set(prar, type, i, v) (*rarray_fast_get(prar, type, i) = *(v))
 
+#ifndef RARRAY_SEG_SHIFT
+#	define RARRAY_SEG_SHIFT 4
+#endif
+
+/*
+ * Segmented array, the block k has (1 << (RARRAY_SEG_SHIFT + k)) elements.
+ * Growth never moves the elements, so the pointers stay valid until release
+ */
+struct rarray_seg {
+	int len;
+	int size; // sizeof(element)
+	char *blocks[32 - RARRAY_SEG_SHIFT];
+};
+
 C_FUNCTION_BEGIN
 
 void rarray_init(struct rarray *prar, int elemsize);
 
-// Release "prar->base" but "prar" can still be reused
+// "head->data" is used as storage until "n" is exceeded
+void rarray_init_inline(struct rarray *prar, int elemsize, struct rarray_head *head, int n);
+
+// Release "prar->base" but "prar" can still be reused, an inline head is only emptied
 void rarray_release(struct rarray *prar);
 
 // Increase capacity only
@@ -41,5 +86,175 @@ void *rarray_pop(struct rarray *prar);
 void *rarray_get(struct rarray *prar, int index);
 void rarray_set(struct rarray *prar, int index, void *value);
 
+// bulk operations, "values" could be NULL to leave the new elements uninitialized
+int rarray_push_n(struct rarray *prar, void *values, int n);
+void rarray_insert_range(struct rarray *prar, int index, void *values, int n);
+void rarray_erase_range(struct rarray *prar, int index, int n);
+
+// by qsort/bsearch style "cmp", use RARRAY_DEFINE_ORDER for the inlined comparator
+void rarray_sort(struct rarray *prar, int (*cmp)(const void *, const void *));
+int rarray_lower_bound(struct rarray *prar, const void *key, int (*cmp)(const void *, const void *));
+
+// segmented array
+void rarray_seg_init(struct rarray_seg *seg, int elemsize);
+void rarray_seg_release(struct rarray_seg *seg);
+
+// Set "len" and allocate the blocks if exceeded, returns -1 if out of memory and "len" is unchanged
+int rarray_seg_setlen(struct rarray_seg *seg, int len);
+
+#define rarray_seg_len(seg) ((seg)->len)
+
+// returns the address of new element, NULL if out of memory
+void *rarray_seg_push(struct rarray_seg *seg, void *value);
+void *rarray_seg_pop(struct rarray_seg *seg);
+void *rarray_seg_get(struct rarray_seg *seg, int index);
+void rarray_seg_set(struct rarray_seg *seg, int index, void *value);
+
 C_FUNCTION_END
+
+/*
+ * Generates "struct name" and the typed inline functions name_init, name_release, name_len,
+ * name_cap, name_reserve, name_push, name_pop, name_get, name_set,
+ * name_push_n, name_insert_range and name_erase_range.
+ * The layout is the same as "struct rarray", so rarray_xxx() still works on "(struct rarray *)arr"
+ */
+#define RARRAY_DEFINE(name, type) \
+struct name { \
+	type *base; \
+	int size; \
+}; \
+static inline void name##_init(struct name *arr) \
+{ \
+	arr->base = NULL; \
+	arr->size = sizeof(type); \
+} \
+static inline void name##_release(struct name *arr) \
+{ \
+	rarray_release((struct rarray *)arr); \
+} \
+static inline int name##_len(struct name *arr) \
+{ \
+	return arr->base ? rarray_head_of(arr->base)->len : 0; \
+} \
+static inline int name##_cap(struct name *arr) \
+{ \
+	return arr->base ? rarray_head_of(arr->base)->cap : 0; \
+} \
+static inline void name##_reserve(struct name *arr, int cap) \
+{ \
+	if (cap > name##_cap(arr)) \
+		rarray_grow((struct rarray *)arr, cap); \
+} \
+static inline int name##_push(struct name *arr, type value) \
+{ \
+	int len = name##_len(arr); \
+	if (len == name##_cap(arr)) \
+		rarray_grow((struct rarray *)arr, len * 2); \
+	arr->base[len] = value; \
+	rarray_head_of(arr->base)->len = ++len; \
+	return len; \
+} \
+static inline type *name##_pop(struct name *arr) \
+{ \
+	int len = name##_len(arr); \
+	if (len == 0) \
+		return NULL; \
+	rarray_head_of(arr->base)->len = --len; \
+	return arr->base + len; \
+} \
+static inline type *name##_get(struct name *arr, int index) \
+{ \
+	if (index < 0 || index >= name##_len(arr)) \
+		return NULL; \
+	return arr->base + index; \
+} \
+static inline void name##_set(struct name *arr, int index, type value) \
+{ \
+	if (index < 0) \
+		return; \
+	if (index >= name##_len(arr)) \
+		rarray_setlen((struct rarray *)arr, index + 1); \
+	arr->base[index] = value; \
+} \
+static inline int name##_push_n(struct name *arr, const type *values, int n) \
+{ \
+	return rarray_push_n((struct rarray *)arr, (void *)values, n); \
+} \
+static inline void name##_insert_range(struct name *arr, int index, const type *values, int n) \
+{ \
+	rarray_insert_range((struct rarray *)arr, index, (void *)values, n); \
+} \
+static inline void name##_erase_range(struct name *arr, int index, int n) \
+{ \
+	rarray_erase_range((struct rarray *)arr, index, n); \
+}
+
+/*
+ * Generates name_sort and name_lower_bound for RARRAY_DEFINE(name, type),
+ * "less(a, b)" is a function or macro of "const type *" which returns true if a < b
+ */
+#define RARRAY_DEFINE_ORDER(name, type, less) \
+static inline void name##_sort_range(type *a, int n) \
+{ \
+	type x; \
+	while (n > 16) { \
+		int m = n >> 1; \
+		if (less(&a[m], &a[0])) { \
+			x = a[m]; a[m] = a[0]; a[0] = x; \
+		} \
+		if (less(&a[n - 1], &a[m])) { \
+			x = a[m]; a[m] = a[n - 1]; a[n - 1] = x; \
+			if (less(&a[m], &a[0])) { \
+				x = a[m]; a[m] = a[0]; a[0] = x; \
+			} \
+		} \
+		type pivot = a[m]; \
+		int i = -1; \
+		int j = n; \
+		for (;;) { \
+			do i++; while (less(&a[i], &pivot)); \
+			do j--; while (less(&pivot, &a[j])); \
+			if (i >= j) \
+				break; \
+			x = a[i]; a[i] = a[j]; a[j] = x; \
+		} \
+		int left = j + 1; \
+		if (left < n - left) { \
+			name##_sort_range(a, left); \
+			a += left; \
+			n -= left; \
+		} else { \
+			name##_sort_range(a + left, n - left); \
+			n = left; \
+		} \
+	} \
+	for (int i = 1; i < n; i++) { \
+		int k = i; \
+		x = a[i]; \
+		while (k > 0 && less(&x, &a[k - 1])) { \
+			a[k] = a[k - 1]; \
+			k--; \
+		} \
+		a[k] = x; \
+	} \
+} \
+static inline void name##_sort(struct name *arr) \
+{ \
+	name##_sort_range(arr->base, name##_len(arr)); \
+} \
+static inline int name##_lower_bound(struct name *arr, const type *key) \
+{ \
+	int i = 0; \
+	int j = name##_len(arr); \
+	while (i < j) { \
+		int k = (i + j) >> 1; \
+		if (less(&arr->base[k], key)) { \
+			i = k + 1; \
+		} else { \
+			j = k; \
+		} \
+	} \
+	return i; \
+}
+
 #endif
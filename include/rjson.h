@@ -32,6 +32,7 @@ enum rjson_kind {
 	KString,
 	KObject,
 	KArray,
+	KInteger, // the number literal without fraction and exponent, and fits in int64
 };
 // NOTE: It should be created indirectly by "struct rjson_vitem"
 struct rjson_value {
@@ -40,6 +41,7 @@ struct rjson_value {
 	union {
 		int                         istrue; // bool
 		double                      number; // number
+		int64_t                    integer; // if KInteger
 		rj_wchars                   string; // String
 		struct {                            // if KArray or KObject
 			struct rjson_vitem   *head;
@@ -62,18 +64,27 @@ struct rjson {
 	struct rjson_value                   *value;
 };
 
+enum rjson_engine {
+	RJSON_ENGINE_SLR = 0, // the generated lexer and SLR tables
+	RJSON_ENGINE_INDEX,   // two-stage structural index, falls back to SLR for comments or malformed input
+};
+
 struct rjson_parser {
 	struct rjson                           json;
-	struct rarray                        parray; // <struct pos_wchars>
+	rj_wchars                            string; // the string being decoded by lexer
+	int                                  strpos;
 	struct crlf_counter                 crlfcnt;
 	rj_wchars                          filename;
 	struct rlex                             lex;
 	struct rstream                       stream; // stream
-};
-
-struct pos_wchars {
-	int pos;
-	rj_wchars wcs;
+	enum rjson_engine                    engine; // of rjson_parser_read(), RJSON_ENGINE_SLR by default
+	// rjson_parser_feed(), the input which is not lexed yet
+	void                                *window; // LEXCHAR
+	int                                  winlen;
+	int                                  wincap;
+	int                                 scanned; // [0, scanned) of window is scanned
+	int                                    safe; // no token crosses window[safe]
+	int                                    scan; // the scanner state at window[scanned]
 };
 
 
@@ -91,8 +102,16 @@ rj_wchars rj_wchars_fromstr(struct rjson *rj, char *src, int len);
 
 rj_wchars rj_wchars_alloc(struct rjson *rj, int len);
 
+// Reserves "len" characters in wcspool, then gives back the unused tail by rj_wchars_commit(), NULL if out of memory
+rj_wchars rj_wchars_reserve(struct rjson *rj, int len);
+
+rj_wchars rj_wchars_commit(struct rjson *rj, rj_wchars wcs, int len);
+
 rj_wchars rj_wchars_flush(struct rjson *rj, struct wcsbuf *buffer);
 
+// Gives "wcs" back to wcspool if it's the last one allocated, otherwise it's kept until rjson_release()
+void rj_wchars_free(struct rjson *rj, rj_wchars wcs);
+
 // rjson_value
 
 struct rjson_value *rjvalue_null(struct rjson *rj);
@@ -101,6 +120,14 @@ struct rjson_value *rjvalue_bool(struct rjson *rj, int istrue);
 
 struct rjson_value *rjvalue_number(struct rjson *rj, double number);
 
+struct rjson_value *rjvalue_integer(struct rjson *rj, int64_t integer);
+
+// the number of KNumber or KInteger, otherwise 0
+double rjvalue_as_number(struct rjson_value *value);
+
+// KNumber is truncated toward zero and saturated to the int64 range, NaN is 0
+int64_t rjvalue_as_integer(struct rjson_value *value);
+
 struct rjson_value *rjvalue_from_wcs(struct rjson *rj, wchar_t *wcs, int len);
 
 struct rjson_value *rjvalue_from_cstr(struct rjson *rj, char *str, int len);
@@ -128,5 +155,45 @@ void rjvalue_string(struct wcsbuf *buffer, struct rjson_value *value, int tn);
 
 void rjson_print(struct rjson *rj, int tn, FILE *stream);
 
+// rjson_parser
+
+/*
+ * Initializes "parser" and parses the file into parser->json.value, "path" = NULL means stdin.
+ * The regular file is mapped read-only and lexed in place, the others(e.g. pipes) are read by rjson_parser_feed().
+ * Returns 0 if the file can't be opened, otherwise rjson_parser_release() is required
+ */
+int rjson_parse_file(struct rjson_parser *parser, const char *path);
+
+/*
+ * Push-style parsing, "parser" is initialized by rjson_parser_init(parser, filename, NULL, 0),
+ * then the document is given by successive calls, "len"(in LEXCHARs) = 0 means the end of input.
+ * Returns 1 if parser->json.value is done, or 0 if more input is required
+ */
+int rjson_parser_feed(struct rjson_parser *parser, const void *data, int len);
+
+/*
+ * SAX-style events, the callbacks could be NULL.
+ * The "key" and "string" are valid only during the callback, their length is rj_wchars_length()
+ */
+struct rjson_sax {
+	void *ud;
+	void (*begin_object)(void *ud);
+	void (*end_object)(void *ud);
+	void (*begin_array)(void *ud);
+	void (*end_array)(void *ud);
+	void (*on_key)(void *ud, rj_wchars key);
+	void (*on_string)(void *ud, rj_wchars string);
+	void (*on_number)(void *ud, double number);
+	void (*on_integer)(void *ud, int64_t integer); // the literal which would be KInteger
+	void (*on_bool)(void *ud, int istrue);
+	void (*on_null)(void *ud);
+};
+
+/*
+ * Drives "sax" by the lexer of "parser" which is initialized by rjson_parser_init(),
+ * no rjson_value is allocated, the memory is bounded by the nesting depth and the longest string
+ */
+void rjson_parser_sax(struct rjson_parser *parser, const struct rjson_sax *sax);
+
 C_FUNCTION_END
 #endif
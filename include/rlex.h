@@ -15,6 +15,7 @@ struct rlex {
 	int ___x;  // align pad
 	void *src; // LEXCHAR
 	int (*token)(struct rlex *lex);
+	void *value; // the value of current token if any, set by lexer and taken by rstream
 };
 
 #define rlex_token(lex)     ((lex)->token(lex))
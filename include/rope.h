@@ -0,0 +1,45 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0
+ */
+
+#ifndef R_ROPE_H
+#define R_ROPE_H
+#include "rbtree_augmented.h"
+#include "crlf_counter.h"
+
+#ifndef ROPE_LEAF_SIZE
+#	define ROPE_LEAF_SIZE 1024
+#endif
+
+/*
+ * Text rope, The leaves are strbuf-style chunks which are indexed by an augmented rbtree,
+ * every node keeps the bytes and '\n' counts of its subtree,
+ * so insert, delete, slice and offset => line are all O(log n).
+ * The leaves under half of ROPE_LEAF_SIZE are merged with their neighbours after edits
+ */
+struct rope {
+	struct rb_root root;
+};
+
+#define ROPE_INIT  (struct rope){ RB_ROOT }
+
+C_FUNCTION_BEGIN
+
+void rope_init(struct rope *rope);
+void rope_release(struct rope *rope);
+
+int rope_length(struct rope *rope); // in bytes
+int rope_lines(struct rope *rope);  // number of '\n'
+
+// returns -1 if out of memory and the rope is unchanged, otherwise 0
+int  rope_insert(struct rope *rope, int pos, const char *src, int len);
+void rope_delete(struct rope *rope, int pos, int len);
+
+// copy [pos, pos + len) to out without '\0', returns the number of bytes copied, 0 if pos is out of range
+int  rope_slice(struct rope *rope, int pos, int len, char *out);
+
+// same as crlf_get
+struct lncolumn rope_get(struct rope *rope, int pos);
+
+C_FUNCTION_END
+#endif
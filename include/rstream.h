@@ -6,6 +6,21 @@
 #define R_STREAM_H
 #include "rlex.h"
 
+#ifndef rs_realloc
+#	define rs_realloc realloc
+#endif
+#ifndef rs_free
+#	define rs_free free
+#endif
+
+// the max number of tokens in stream(SLR stack + lookahead)
+#ifndef RSTREAM_LIMIT
+#	define RSTREAM_LIMIT (1 << 20)
+#endif
+
+// the term of lookahead if lexer reaches the end of a partial input, see rstream.partial
+#define RSTREAM_PENDING (-1)
+
 struct rstream_tok {
 	struct rlex_position pos;
 	int state;
@@ -22,10 +37,29 @@ struct rstream_tok {
 	};
 };
 
+// 8 bytes token of tape, "term" must be < 32 and the max length of token is (1 << 26) - 1 characters
+struct rstream_lexeme {
+	int offset;
+	unsigned int term : 5;
+	unsigned int valued : 1; // the next one of "tape_values"
+	unsigned int len : 26;
+};
+
 struct rstream {
 	struct rstream_tok *head;
 	struct rstream_tok *tail;
 	struct rlex *lex;
+	struct rstream_tok *base; // "cached" or heap
+	int cap;
+	int limit;                // RSTREAM_LIMIT by default
+	int partial;              // the input of lexer is a prefix of document, then Eof is RSTREAM_PENDING
+	// token tape, disabled if NULL
+	struct rstream_lexeme *tape;
+	void **tape_values;       // lex->value of tokens in tape
+	int tape_pos;
+	int tape_len;
+	int tape_cap;
+	int tape_vpos;
 	struct rstream_tok cached[64];
 };
 
@@ -34,14 +68,29 @@ extern "C" {
 #endif
 
 /*
- * The returned (rstream_tok *) will point to an element from rstream.cached[X],
+ * The returned (rstream_tok *) will point to an element from rstream.base[X],
+ * it's invalid after the next call which could grow the stream
  */
 struct rstream_tok *rstream_peek(struct rstream *stream, int i);
 
+/*
+ * The slrloop returns NULL and keeps its stack if the lookahead is RSTREAM_PENDING,
+ * then slrloop(stream, -1, exp) resumes it after more input is given to lexer
+ */
+#define rstream_suspended(stream) ((stream)->head != (stream)->base)
+
 void rstream_junk(struct rstream *stream, int n);
 
 void rstream_init(struct rstream *stream, struct rlex *lex);
 
+void rstream_release(struct rstream *stream);
+
+/*
+ * Tokenizes "block" tokens at a time into a tape before they are consumed by parser,
+ * so the lexer and the parser each run in their own tight loop. 0 to disable
+ */
+void rstream_tape(struct rstream *stream, int block);
+
 struct rstream_tok *rstream_reserve(struct rstream *stream);           // For internal
 
 struct rstream_tok *rstream_next(struct rstream *stream);              // For internal
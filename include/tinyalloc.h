@@ -77,6 +77,12 @@ void bumpalloc_init(struct bumpalloc_root *fixed, int chksize);
 
 void *bumpalloc(struct bumpalloc_root *bump, int size);
 
+/*
+ * Gives back the unused tail of "ptr" which is allocated with "size", "newsize" = 0 gives back the whole block.
+ * Only works if "ptr" is the last block returned by bumpalloc(), otherwise nothing happens.
+ */
+void bumpshrink(struct bumpalloc_root *bump, void *ptr, int size, int newsize);
+
 void bumpreset(struct bumpalloc_root *bump);
 
 void bumpdestroy(struct bumpalloc_root *bump);
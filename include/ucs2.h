@@ -22,5 +22,76 @@ int wcstoutf8(unsigned char *out, const unsigned short *src, int srclen);
 
 int utf8towcs(unsigned short *out, const unsigned char *src, int srcbytes);
 
+/*
+ * The worst-case output size, so that the conversion could be done in one pass:
+ *
+ * ```c
+ * unsigned short *out = malloc(UTF8TOWCS_BOUND(bytes) * sizeof(unsigned short));
+ * int len = utf8towcs(out, src, bytes); // the real length
+ * ```
+ */
+#define UTF8TOWCS_BOUND(srcbytes)  (srcbytes)        // one unit per byte at most
+#define WCSTOUTF8_BOUND(srclen)    ((srclen) * 3)    // 3 bytes per unit at most
+
+/*
+ * Validation only, runs the vectorized lookup-table check if AVX2 is available.
+ * @srcbytes: If this parameter is -1, the string is null-terminated
+ * @err_offset: optional, the start offset of the first invalid or truncated sequence, or "srcbytes" if valid
+ */
+bool utf8_validate(const unsigned char *src, int srcbytes, int *err_offset);
+
+/*
+ * Streaming transcoder, the state is carried across calls,
+ * so that a multi-byte sequence or a surrogate pair could be split between two input blocks.
+ *
+ * ```c
+ * struct utf8_decoder dec = UTF8_DECODER_INIT;
+ * while ((n = read(fd, block, sizeof(block))) > 0) {
+ *	int len = utf8_decoder_feed(&dec, out, block, n); // "out" needs UTF8_DECODER_BOUND(n) units
+ *	if (utf8_decoder_error(&dec))
+ *		break;
+ * }
+ *
+ * struct utf8_encoder enc = UTF8_ENCODER_INIT;
+ * // for each block: "out" needs UTF8_ENCODER_BOUND(n) bytes
+ * len = utf8_encoder_feed(&enc, out, block, n);
+ * // at the end of input
+ * len = utf8_encoder_flush(&enc, out);
+ * ```
+ */
+struct utf8_decoder {
+	uint32_t state;
+	uint32_t codep;
+};
+
+struct utf8_encoder {
+	unsigned int high; // pending high surrogate
+};
+
+#define UTF8_DECODER_ACCEPT        0
+#define UTF8_DECODER_REJECT        12
+
+#define UTF8_DECODER_INIT          ((struct utf8_decoder){0, 0})
+#define UTF8_ENCODER_INIT          ((struct utf8_encoder){0})
+#define UTF8_DECODER_BOUND(srcbytes)  ((srcbytes) + 1)
+// a high surrogate left pending by the previous block may be flushed before the first unit
+#define UTF8_ENCODER_BOUND(srclen)    ((srclen) * 3 + 3)
+
+// invalid sequence, the decoder stops and consumes nothing further
+#define utf8_decoder_error(dec)    ((dec)->state == UTF8_DECODER_REJECT)
+// an incomplete sequence is waiting for the next block, It's an error at the end of input
+#define utf8_decoder_pending(dec)  ((dec)->state != UTF8_DECODER_ACCEPT && (dec)->state != UTF8_DECODER_REJECT)
+#define utf8_encoder_pending(enc)  ((enc)->high != 0)
+
+// returns the number of units written to "out"
+int utf8_decoder_feed(struct utf8_decoder *dec, unsigned short *out, const unsigned char *src, int srcbytes);
+
+// returns the number of bytes written to "out"
+int utf8_encoder_feed(struct utf8_encoder *enc, unsigned char *out, const unsigned short *src, int srclen);
+
+// writes a pending unpaired high surrogate at the end of input, "out" needs 3 bytes.
+// returns the number of bytes written to "out"
+int utf8_encoder_flush(struct utf8_encoder *enc, unsigned char *out);
+
 C_FUNCTION_END
-#endif
\ No newline at end of file
+#endif
@@ -21,7 +21,15 @@ void wcsbuf_release(struct wcsbuf *buf);
 
 void wcsbuf_append_char(struct wcsbuf *buf, wchar_t c);
 void wcsbuf_append_string(struct wcsbuf *buf, wchar_t *string, int len);
+/*
+ * Returns a writable space of at least "len" elements at the end of buffer,
+ * then wcsbuf_commit() the number of elements actually written. Returns NULL if out of memory
+ */
+wchar_t *wcsbuf_reserve(struct wcsbuf *buf, int len);
+void wcsbuf_commit(struct wcsbuf *buf, int len);
+
 void wcsbuf_append_int(struct wcsbuf *buf, int i);
+void wcsbuf_append_int64(struct wcsbuf *buf, int64_t i);
 void wcsbuf_append_float(struct wcsbuf *buf, float f, int fixed);
 void wcsbuf_append_double(struct wcsbuf *buf, double lf, int fixed);
 
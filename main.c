@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
 #include <time.h>
 #include "rclibs.h"
 #include "slist.h"
@@ -13,6 +14,7 @@
 #include "strbuf.h"
 #include "wcsbuf.h"
 #include "rarray.h"
+#include "rope.h"
 
 struct blk_s {
 	int n;
@@ -37,6 +39,88 @@ static void t_ucs2() {
 	assert(utf8towcs(NULL     , utf8, bytes) == wslen);
 	assert(utf8towcs(ucs2_copy, utf8,    -1) == wslen + 1);
 	assert(memcmp(ucs2_copy, ucs2, wslen * sizeof(wchar_t)) == 0);
+
+	// long ASCII runs for the SIMD kernels
+	#define NREPEAT 37
+	unsigned char *lutf8 = malloc(NREPEAT * (bytes + 45) + 1);
+	wchar_t *lucs2 = malloc((NREPEAT * (wslen + 45) + 1) * sizeof(wchar_t));
+	int lbytes = 0, lwslen = 0;
+	for (int i = 0; i < NREPEAT; i++) {
+		int n = 1 + (i * 7) % 45; // ASCII run length
+		for (int k = 0; k < n; k++) {
+			lutf8[lbytes++] = 'a' + (k % 26);
+			lucs2[lwslen++] = 'a' + (k % 26);
+		}
+		memcpy(lutf8 + lbytes, utf8, bytes);
+		memcpy(lucs2 + lwslen, ucs2, wslen * sizeof(wchar_t));
+		lbytes += bytes;
+		lwslen += wslen;
+	}
+	lutf8[lbytes] = 0;
+	lucs2[lwslen] = 0;
+	unsigned char *lutf8_copy = malloc(lbytes + 8);
+	wchar_t *lucs2_copy = malloc((lwslen + 1) * sizeof(wchar_t));
+	assert(wcstoutf8(NULL      , lucs2, lwslen) == lbytes);
+	assert(wcstoutf8(lutf8_copy, lucs2,     -1) == lbytes + 1);
+	assert(memcmp(lutf8_copy, lutf8, lbytes + 1) == 0);
+	assert(utf8towcs(NULL      , lutf8, lbytes) == lwslen);
+	assert(utf8towcs(lucs2_copy, lutf8,     -1) == lwslen + 1);
+	assert(memcmp(lucs2_copy, lucs2, (lwslen + 1) * sizeof(wchar_t)) == 0);
+
+	// streaming, feeds blocks of 1..7 elements
+	struct utf8_decoder dec = UTF8_DECODER_INIT;
+	struct utf8_encoder enc = UTF8_ENCODER_INIT;
+	int i = 0, k = 0, n;
+	for (int blk = 1; i < lbytes; blk = blk % 7 + 1) {
+		n = i + blk > lbytes ? lbytes - i : blk;
+		k += utf8_decoder_feed(&dec, lucs2_copy + k, lutf8 + i, n);
+		i += n;
+	}
+	assert(k == lwslen && !utf8_decoder_pending(&dec) && !utf8_decoder_error(&dec));
+	assert(memcmp(lucs2_copy, lucs2, lwslen * sizeof(wchar_t)) == 0);
+	for (i = 0, k = 0; i < lwslen; i += n) {
+		n = i + 3 > lwslen ? lwslen - i : 3;
+		k += utf8_encoder_feed(&enc, lutf8_copy + k, lucs2 + i, n);
+	}
+	assert(k == lbytes && !utf8_encoder_pending(&enc));
+	assert(memcmp(lutf8_copy, lutf8, lbytes) == 0);
+	// validation
+	int err;
+	assert(utf8_validate(lutf8, lbytes, &err) && err == lbytes);
+	assert(utf8_validate(lutf8, -1, NULL));
+	const char *invalids[] = {"\xFF", "\xC0\x80", "\xED\xA0\x80", "\xF4\x90\x80\x80", "\xE4\xB8", "\x80"};
+	for (int m = 0; m < ARRAYSIZE(invalids); m++) {
+		int ilen = (int)strlen(invalids[m]);
+		for (int at = 0; at < lbytes; at += 13) {
+			while (at > 0 && (lutf8[at] & 0xC0) == 0x80)
+				at++; // char boundary
+			memcpy(lutf8_copy, lutf8, at);
+			memcpy(lutf8_copy + at, invalids[m], ilen);
+			memcpy(lutf8_copy + at + ilen, lutf8 + at, lbytes - at);
+			assert(!utf8_validate(lutf8_copy, lbytes + ilen, &err) && err == at);
+		}
+	}
+	assert(!utf8_validate(lutf8, lbytes - 2, &err) && err == lbytes - 5); // truncated 4-bytes sequence
+	dec = UTF8_DECODER_INIT;
+	utf8_decoder_feed(&dec, lucs2_copy, (const unsigned char *)"\xE4\xB8", 2);
+	assert(utf8_decoder_pending(&dec));
+	utf8_decoder_feed(&dec, lucs2_copy, (const unsigned char *)"A", 1);
+	assert(utf8_decoder_error(&dec));
+	// unpaired high surrogate split from the next unit
+	unsigned char bound[UTF8_ENCODER_BOUND(1)];
+	enc = UTF8_ENCODER_INIT;
+	assert(utf8_encoder_feed(&enc, bound, &(unsigned short){0xD800}, 1) == 0 && utf8_encoder_pending(&enc));
+	assert(utf8_encoder_feed(&enc, bound, &(unsigned short){0x4E00}, 1) == 6 && !utf8_encoder_pending(&enc));
+	assert(memcmp(bound, "\xED\xA0\x80\xE4\xB8\x80", 6) == 0);
+	assert(utf8_encoder_feed(&enc, bound, &(unsigned short){0xDBFF}, 1) == 0);
+	assert(utf8_encoder_flush(&enc, bound) == 3 && !utf8_encoder_pending(&enc));
+	assert(memcmp(bound, "\xED\xAF\xBF", 3) == 0);
+	assert(utf8_encoder_flush(&enc, bound) == 0);
+
+	free(lutf8);
+	free(lucs2);
+	free(lutf8_copy);
+	free(lucs2_copy);
 }
 
 static void t_slist() {
@@ -438,7 +522,8 @@ void t_wcsbuf()
 	wcsbuf_append_char(&buf, '\n');
 
 #	define HANG_ZI L"中文汉字\n"
-	wcsbuf_append_string(&buf, HANG_ZI, wcslen(HANG_ZI));
+	wchar_t *dest = wcsbuf_reserve(&buf, UTF8TOWCS_BOUND(13));
+	wcsbuf_commit(&buf, utf8towcs(dest, (const unsigned char *)"\xE4\xB8\xAD\xE6\x96\x87\xE6\xB1\x89\xE5\xAD\x97\n", 13));
 	wchar_t *result = L"A101\n" TEXT L"B102\n" TEXT L"C103\n" TEXT
 		L"3.1415926535897984\n"
 		L"3.141592741\n"
@@ -471,8 +556,19 @@ void t_wcsbuf()
 	assert(buf.chunks == NULL);
 }
 
+#define int_less(a, b)    (*(a) < *(b))
+
+RARRAY_DEFINE(int_array, int)
+RARRAY_DEFINE_ORDER(int_array, int, int_less)
+
+static int int_compare(const void *a, const void *b)
+{
+	return *(int *)a - *(int *)b;
+}
+
 void t_rarray()
 {
+	struct int_array ints;
 	struct point {
 		int x, y, z;
 	};
@@ -547,6 +643,303 @@ void t_rarray()
 		assert(ptr->x == i && ptr->y == i && ptr->z == i);
 	}
 	rarray_release(&array);
+
+	// typed
+	int_array_init(&ints);
+	assert(int_array_len(&ints) == 0 && int_array_get(&ints, 0) == NULL && int_array_pop(&ints) == NULL);
+	for (int i = 0; i < 100; i++)
+		assert(int_array_push(&ints, i * i) == i + 1);
+	assert(int_array_len(&ints) == 100 && int_array_cap(&ints) >= 100);
+	assert(rarray_len((struct rarray *)&ints) == 100);
+	for (int i = 0; i < 100; i++)
+		assert(*int_array_get(&ints, i) == i * i);
+	int_array_set(&ints, 119, -1);
+	assert(int_array_len(&ints) == 120 && *int_array_get(&ints, 119) == -1);
+	assert(*(int *)rarray_get((struct rarray *)&ints, 99) == 99 * 99);
+	assert(*int_array_pop(&ints) == -1 && int_array_len(&ints) == 119);
+	int_array_reserve(&ints, 1000);
+	assert(int_array_cap(&ints) >= 1000 && int_array_len(&ints) == 119);
+	int_array_release(&ints);
+	assert(int_array_len(&ints) == 0);
+
+	// bulk
+	int values[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+	int_array_push_n(&ints, values, 10);
+	int_array_insert_range(&ints, 5, values, 3);
+	int_array_insert_range(&ints, 0, values + 8, 2);
+	assert(int_array_len(&ints) == 15);
+	int expect[] = {8, 9, 0, 1, 2, 3, 4, 0, 1, 2, 5, 6, 7, 8, 9};
+	assert(memcmp(ints.base, expect, sizeof(expect)) == 0);
+	int_array_erase_range(&ints, 0, 2);
+	int_array_erase_range(&ints, 5, 3);
+	int_array_erase_range(&ints, 8, 100);
+	assert(int_array_len(&ints) == 8 && memcmp(ints.base, values, 8 * sizeof(int)) == 0);
+	int_array_release(&ints);
+
+	// sort, lower_bound
+	for (int n = 0; n < 300; n += 1 + n / 4) {
+		for (int i = 0; i < n; i++)
+			int_array_push(&ints, rand() % (n / 2 + 1));
+		struct rarray copy = {.base = NULL, .size = sizeof(int)};
+		rarray_push_n(&copy, ints.base, n);
+		int_array_sort(&ints);
+		rarray_sort(&copy, int_compare);
+		assert(n == 0 || memcmp(ints.base, copy.base, n * sizeof(int)) == 0);
+		for (int key = -1; key <= n / 2 + 1; key++) {
+			int i = int_array_lower_bound(&ints, &key);
+			assert(i == rarray_lower_bound(&copy, &key, int_compare));
+			assert(i == n || ints.base[i] >= key);
+			assert(i == 0 || ints.base[i - 1] < key);
+		}
+		rarray_release(&copy);
+		int_array_release(&ints);
+	}
+
+	// segmented
+	struct rarray_seg seg;
+	rarray_seg_init(&seg, sizeof(struct point));
+	assert(rarray_seg_len(&seg) == 0 && rarray_seg_get(&seg, 0) == NULL && rarray_seg_pop(&seg) == NULL);
+	struct point *first = rarray_seg_push(&seg, &((struct point) { 0, 0, 0 }));
+	struct point *ptrs[64];
+	ptrs[0] = first;
+	max = 10000;
+	for (int i = 1; i < max; i++) {
+		pt = rarray_seg_push(&seg, &((struct point) { i, i * 2, i * 4 }));
+		if (i < ARRAYSIZE(ptrs))
+			ptrs[i] = pt;
+	}
+	assert(rarray_seg_len(&seg) == max);
+	for (int i = 0; i < max; i++) {
+		pt = rarray_seg_get(&seg, i);
+		assert(pt->x == i && pt->y == i * 2 && pt->z == i * 4);
+		if (i < ARRAYSIZE(ptrs))
+			assert(pt == ptrs[i]);
+	}
+	rarray_seg_set(&seg, max + 100, &((struct point) { -1, -1, -1 }));
+	assert(rarray_seg_len(&seg) == max + 101 && rarray_seg_get(&seg, 0) == first);
+	pt = rarray_seg_pop(&seg);
+	assert(pt->x == -1 && rarray_seg_len(&seg) == max + 100);
+	assert(rarray_seg_setlen(&seg, -1) == -1 && rarray_seg_len(&seg) == max + 100);
+	rarray_seg_release(&seg);
+	assert(rarray_seg_len(&seg) == 0);
+
+	// small-buffer-optimized
+	RARRAY_SBO(struct point, 8) sbo;
+	rarray_sbo_init(&sbo);
+	assert(rarray_len(&sbo.arr) == 0 && rarray_cap(&sbo.arr) == 8);
+	for (int i = 0; i < 8; i++)
+		rarray_push(&sbo.arr, &((struct point) { i, i * 2, i * 4 }));
+	assert((void *)sbo.arr.base == (void *)sbo.data && rarray_len(&sbo.arr) == 8);
+	pt = rarray_pop(&sbo.arr);
+	assert(pt == &sbo.data[7] && pt->x == 7);
+	rarray_release(&sbo.arr); // emptied only
+	assert((void *)sbo.arr.base == (void *)sbo.data && rarray_len(&sbo.arr) == 0);
+	for (int i = 0; i < 100; i++)
+		rarray_push(&sbo.arr, &((struct point) { i, i * 2, i * 4 }));
+	assert((void *)sbo.arr.base != (void *)sbo.data && rarray_len(&sbo.arr) == 100);
+	for (int i = 0; i < 100; i++) {
+		pt = rarray_get(&sbo.arr, i);
+		assert(pt->x == i && pt->y == i * 2 && pt->z == i * 4);
+	}
+	rarray_release(&sbo.arr);
+	assert(sbo.arr.base == NULL);
+}
+
+void t_crlf()
+{
+	struct crlf_counter crlf;
+	crlf_init(&crlf);
+	struct lncolumn lcn = crlf_get(&crlf, 5);
+	assert(lcn.line == 1 && lcn.column == 6);
+	char text[4096];
+	for (int i = 0; i < ARRAYSIZE(text); i++) {
+		text[i] = (rand() % 7) == 0 ? '\n' : 'x';
+		if (text[i] == '\n')
+			crlf_add(&crlf, i + 1);
+		if (i == ARRAYSIZE(text) / 2) // crlf_get() in the middle of crlf_add()
+			crlf_get(&crlf, i);
+	}
+	int line = 1, column = 1;
+	for (int i = 0; i < ARRAYSIZE(text); i++) {
+		lcn = crlf_get(&crlf, i);
+		assert(lcn.line == line && lcn.column == column);
+		if (text[i] == '\n') {
+			line++;
+			column = 1;
+		} else {
+			column++;
+		}
+	}
+	crlf_release(&crlf);
+
+	// lazy mode
+	const wchar_t wtext[] = L"a\r\n\u010A\u0A00\nb\n";
+	crlf_lazy(&crlf, text, ARRAYSIZE(text), 1);
+	line = 1, column = 1;
+	for (int i = 0; i < ARRAYSIZE(text); i++) {
+		lcn = crlf_get(&crlf, i);
+		assert(lcn.line == line && lcn.column == column);
+		if (text[i] == '\n') {
+			line++;
+			column = 1;
+		} else {
+			column++;
+		}
+	}
+	crlf_release(&crlf);
+	crlf_lazy(&crlf, wtext, ARRAYSIZE(wtext) - 1, sizeof(wchar_t));
+	lcn = crlf_get(&crlf, 5);
+	assert(lcn.line == 2 && lcn.column == 3);
+	lcn = crlf_get(&crlf, 6);
+	assert(lcn.line == 3 && lcn.column == 1);
+	lcn = crlf_get(&crlf, 8);
+	assert(lcn.line == 4 && lcn.column == 1);
+	crlf_release(&crlf);
+
+	// batch, columns in code points
+	const char *utf8 = "\xE4\xB8\xAD\xE6\x96\x87\n"
+		"ab\xF0\x9F\x98\x80" "c\r\n"
+		"\n"
+		"\xC3\xA9\xC3\xA9x";
+	int utf8len = (int)strlen(utf8);
+	int positions[256];
+	struct lncolumn many[ARRAYSIZE(positions)];
+	for (int i = 0; i < ARRAYSIZE(positions); i++)
+		positions[i] = i < utf8len + 2 ? i : rand() % (utf8len + 2);
+	crlf_lazy(&crlf, utf8, utf8len, 1);
+	crlf_get_many(&crlf, positions, ARRAYSIZE(positions), many);
+	for (int i = 0; i < ARRAYSIZE(positions); i++) {
+		int pos = positions[i];
+		line = 1, column = 1;
+		for (int j = 0; j < pos; j++) {
+			if (j < utf8len && utf8[j] == '\n') {
+				line++;
+				column = 1;
+			} else if (j >= utf8len || (utf8[j] & 0xC0) != 0x80) {
+				column++;
+			}
+		}
+		assert(many[i].line == line && many[i].column == column);
+	}
+	lcn = crlf_get(&crlf, 13); // in bytes
+	assert(lcn.line == 2 && lcn.column == 7);
+	assert(many[13].line == 2 && many[13].column == 4);
+	crlf_release(&crlf);
+
+	// delta-compressed
+	struct crlf_packed packed;
+	crlf_packed_init(&packed);
+	crlf_init(&crlf);
+	lcn = crlf_packed_get(&packed, 9);
+	assert(lcn.line == 1 && lcn.column == 10);
+	int pos = 0;
+	for (int i = 0; i < 1000; i++) {
+		pos += 1 + (i % 3 == 0 ? rand() % 50000 : rand() % 100);
+		crlf_add(&crlf, pos);
+		crlf_packed_add(&packed, pos);
+	}
+	assert(rarray_len(&packed.bytes) < 1000 * 2);
+	for (int i = 0; i < pos + 100; i += 1 + rand() % 50) {
+		struct lncolumn a = crlf_get(&crlf, i);
+		lcn = crlf_packed_get(&packed, i);
+		assert(a.line == lcn.line && a.column == lcn.column);
+	}
+	crlf_packed_release(&packed);
+	crlf_release(&crlf);
+}
+
+// the reference is a plain string
+static void rope_check(struct rope *rope, char *ref, int len)
+{
+	char *ptr = malloc(len + 1);
+	assert(rope_length(rope) == len);
+	assert(rope_slice(rope, 0, len + 10, ptr) == len && memcmp(ptr, ref, len) == 0);
+	int line = 1, column = 1;
+	for (int i = 0; i < len; i++) {
+		struct lncolumn lcn = rope_get(rope, i);
+		assert(lcn.line == line && lcn.column == column);
+		if (ref[i] == '\n') {
+			line++;
+			column = 1;
+		} else {
+			column++;
+		}
+	}
+	assert(rope_lines(rope) == line - 1);
+	free(ptr);
+}
+
+static int rope_leaves(struct rope *rope)
+{
+	int n = 0;
+	for (struct rb_node *node = rb_first(&rope->root); node; node = rb_next(node))
+		n++;
+	return n;
+}
+
+void t_rope()
+{
+	#define RMAX (1024 * 16)
+	struct rope rope;
+	rope_init(&rope);
+	char *ref = malloc(RMAX);
+	char *text = malloc(RMAX);
+	int len = 0;
+	for (int i = 0; i < RMAX; i++)
+		text[i] = (rand() & 15) == 0 ? '\n' : 'a' + (i % 26);
+	for (int k = 0; k < 200; k++) {
+		int pos = len ? rand() % (len + 1) : 0;
+		int n = rand() & (k & 1 ? 31 : 2047);
+		if ((rand() & 3) == 0) {
+			if (pos + n > len)
+				n = len - pos;
+			rope_delete(&rope, pos, n);
+			memmove(ref + pos, ref + pos + n, len - pos - n);
+			len -= n;
+		} else {
+			if (len + n > RMAX)
+				continue;
+			int off = rand() % (RMAX - n + 1);
+			rope_insert(&rope, pos, text + off, n);
+			memmove(ref + pos + n, ref + pos, len - pos);
+			memcpy(ref + pos, text + off, n);
+			len += n;
+		}
+		if ((k & 15) == 0)
+			rope_check(&rope, ref, len);
+	}
+	rope_check(&rope, ref, len);
+	// single char edits must not leave a trail of tiny leaves
+	for (int k = 0; k < 4000; k++) {
+		int pos = rand() % (len + 1);
+		if (k & 1) {
+			if (pos == len)
+				continue;
+			rope_delete(&rope, pos, 1);
+			memmove(ref + pos, ref + pos + 1, len - pos - 1);
+			len--;
+		} else {
+			assert(rope_insert(&rope, pos, text + k, 1) == 0);
+			memmove(ref + pos + 1, ref + pos, len - pos);
+			ref[pos] = text[k];
+			len++;
+		}
+	}
+	rope_check(&rope, ref, len);
+	assert(rope_leaves(&rope) <= 2 * len / ROPE_LEAF_SIZE + 2);
+	char tmp[64];
+	if (len > 100) {
+		assert(rope_slice(&rope, 50, 40, tmp) == 40 && memcmp(tmp, ref + 50, 40) == 0);
+		assert(rope_slice(&rope, len - 3, 40, tmp) == 3 && memcmp(tmp, ref + len - 3, 3) == 0);
+	}
+	assert(rope_slice(&rope, len, 40, tmp) == 0);
+	assert(rope_slice(&rope, len + 100, 40, tmp) == 0);
+	assert(rope_slice(&rope, -1, 40, tmp) == 0);
+	rope_delete(&rope, 0, len);
+	assert(rope_length(&rope) == 0 && rope.root.rb_node == NULL);
+	rope_release(&rope);
+	free(text);
+	free(ref);
 }
 
 #include "rjson.h"
@@ -575,6 +968,8 @@ void t_rjson()
 	rjvalue_object_set(&rjson, NULL, L"bool", mk_bool(0));
 	rjvalue_object_set(&rjson, NULL, L"name", mk_wchars(L"Akuma's \"tek\"ken"));
 	rjvalue_object_set(&rjson, NULL, L"number", mk_number(3.1415926));
+	struct rjson_value *cstr = rjvalue_from_cstr(&rjson, "\xE4\xB8\xAD\xE6\x96\x87 A", -1);
+	rjvalue_object_set(&rjson, NULL, L"cstr", cstr);
 
 	//rjson_print(&rjson,  0, stdout);
 	//rjson_print(&rjson, -1, stdout);
@@ -585,9 +980,409 @@ void t_rjson()
 	assert(rjvalue_object_get(rjson.value, L"todo.qwert")->number == 101.);
 	assert(rjvalue_object_get(rjson.value, L"bool")->istrue == 0);
 	assert(rjvalue_object_get(rjson.value, L"what.is.love") == array);
+	assert(rj_wchars_length(cstr->string) == 4 && cstr->string[0] == 0x4E2D && cstr->string[3] == 'A');
 	rjson_release(&rjson);
 }
 
+void rjson_parser_init(struct rjson_parser *parser, wchar_t *filename, char *text, int len);
+void rjson_parser_release(struct rjson_parser *parser);
+void rjson_parser_read(struct rjson_parser *parser);
+
+static void rjson_parser_dump(struct rjson_parser *parser, struct wcsbuf *out)
+{
+	wcsbuf_reset(out);
+	rjvalue_string(out, parser->json.value, -1);
+}
+
+// SAX events and DOM are both written as the same event text
+static void sax_begin_object(void *ud) { wcsbuf_append_char(ud, '{'); }
+static void sax_end_object(void *ud) { wcsbuf_append_char(ud, '}'); }
+static void sax_begin_array(void *ud) { wcsbuf_append_char(ud, '['); }
+static void sax_end_array(void *ud) { wcsbuf_append_char(ud, ']'); }
+static void sax_on_key(void *ud, rj_wchars key)
+{
+	wcsbuf_append_char(ud, 'K');
+	wcsbuf_append_string(ud, key, rj_wchars_length(key));
+	wcsbuf_append_char(ud, ';');
+}
+static void sax_on_string(void *ud, rj_wchars string)
+{
+	wcsbuf_append_char(ud, 'S');
+	wcsbuf_append_string(ud, string, rj_wchars_length(string));
+	wcsbuf_append_char(ud, ';');
+}
+static void sax_on_number(void *ud, double number)
+{
+	wcsbuf_append_char(ud, 'N');
+	wcsbuf_append_double(ud, number, -1);
+}
+static void sax_on_integer(void *ud, int64_t integer)
+{
+	wcsbuf_append_char(ud, 'I');
+	wcsbuf_append_int64(ud, integer);
+}
+static void sax_on_bool(void *ud, int istrue) { wcsbuf_append_char(ud, istrue ? 'T' : 'F'); }
+static void sax_on_null(void *ud) { wcsbuf_append_char(ud, 'Z'); }
+
+static void sax_of_dom(struct wcsbuf *out, struct rjson_value *value)
+{
+	struct rjson_vitem *child;
+	switch (value->kind) {
+	case KObject:
+	case KArray:
+		value->kind == KObject ? sax_begin_object(out) : sax_begin_array(out);
+		for (child = value->head; child; child = child->next) {
+			if (value->kind == KObject)
+				sax_on_key(out, child->key);
+			sax_of_dom(out, &child->value);
+		}
+		value->kind == KObject ? sax_end_object(out) : sax_end_array(out);
+		break;
+	case KString:
+		sax_on_string(out, value->string);
+		break;
+	case KNumber:
+		sax_on_number(out, value->number);
+		break;
+	case KInteger:
+		sax_on_integer(out, value->integer);
+		break;
+	case KBool:
+		sax_on_bool(out, value->istrue);
+		break;
+	case KNull:
+		sax_on_null(out);
+		break;
+	}
+}
+
+// random JSON for the differential test of engines
+static uint32_t rand_json_seed = 1;
+
+static int rand_json_next(int n)
+{
+	rand_json_seed = rand_json_seed * 1103515245 + 12345;
+	return (int)((rand_json_seed >> 8) % n);
+}
+
+static void rand_json_space(struct strbuf *out)
+{
+	static const char *spaces[] = {"", "", " ", "\t", "\n", "\r\n", "    "};
+	strbuf_append_string(out, (char *)spaces[rand_json_next(ARRAYSIZE(spaces))], -1);
+}
+
+static void rand_json_string(struct strbuf *out)
+{
+	static const char *pieces[] = {
+		"a", "Z", "0", " ", "\\n", "\\r", "\\t", "\\\"", "\\\\", "\\u00e9", "\\/",
+		"\xC3\xA9", "\xE4\xB8\xAD", "\xF0\x9F\x98\x80", "{", "]", ",", ":", "/", "/*",
+		"abcdefghijklmnopqrstuvwxyz0123456789", "\\\\\\\\\\\"",
+	};
+	int n = rand_json_next(4) ? rand_json_next(8) : rand_json_next(80);
+	strbuf_append_char(out, '"');
+	for (int i = 0; i < n; i++)
+		strbuf_append_string(out, (char *)pieces[rand_json_next(ARRAYSIZE(pieces))], -1);
+	strbuf_append_char(out, '"');
+}
+
+static void rand_json_value(struct strbuf *out, int depth)
+{
+	static const char *scalars[] = {
+		"0", "7", "-1", "- 42", "123456789012", "9223372036854775807", "-9223372036854775808",
+		"18446744073709551616", "3.25", "-0.5", ".5", "5.", "1e10", "2.5E-3", "-1.7976931348623157e308",
+		"0.1", "true", "false", "null",
+	};
+	int kind = depth > 5 ? 2 + rand_json_next(2) : rand_json_next(4);
+	rand_json_space(out);
+	if (kind == 0 || kind == 1) {
+		int n = rand_json_next(6);
+		strbuf_append_char(out, kind ? '[' : '{');
+		for (int i = 0; i < n; i++) {
+			if (i)
+				strbuf_append_char(out, ',');
+			if (!kind) {
+				rand_json_space(out);
+				rand_json_string(out);
+				rand_json_space(out);
+				strbuf_append_char(out, ':');
+			}
+			rand_json_value(out, depth + 1);
+		}
+		rand_json_space(out);
+		strbuf_append_char(out, kind ? ']' : '}');
+	} else if (kind == 2) {
+		rand_json_string(out);
+	} else {
+		strbuf_append_string(out, (char *)scalars[rand_json_next(ARRAYSIZE(scalars))], -1);
+	}
+	rand_json_space(out);
+}
+
+// parses "text" by "engine" and writes the DOM as events
+static void rjson_parser_events(char *text, int len, enum rjson_engine engine, struct wcsbuf *out)
+{
+	struct rjson_parser parser;
+	rjson_parser_init(&parser, L"engine", text, len);
+	parser.engine = engine;
+	rjson_parser_read(&parser);
+	wcsbuf_reset(out);
+	if (parser.json.value)
+		sax_of_dom(out, parser.json.value);
+	rjson_parser_release(&parser);
+}
+
+// Both engines must give the same events
+static void rjson_engines_check(char *text, int len, struct wcsbuf *slr, struct wcsbuf *index)
+{
+	rjson_parser_events(text, len, RJSON_ENGINE_SLR, slr);
+	rjson_parser_events(text, len, RJSON_ENGINE_INDEX, index);
+	int n = wcsbuf_length(slr);
+	assert(n == wcsbuf_length(index));
+	wchar_t *a = malloc((n + 1) * 2 * sizeof(wchar_t));
+	wcsbuf_to_string(slr, a);
+	wcsbuf_to_string(index, a + n + 1);
+	assert(wcscmp(a, a + n + 1) == 0);
+	free(a);
+}
+
+void t_rjson_engines()
+{
+	struct strbuf doc;
+	struct wcsbuf slr, index;
+	strbuf_init(&doc);
+	wcsbuf_init(&slr);
+	wcsbuf_init(&index);
+	for (int round = 0; round < 2000; round++) {
+		strbuf_reset(&doc);
+		if (round % 100 == 99) {
+			strbuf_append_string(&doc, "/* the index engine falls back to SLR */ ", -1);
+		}
+		rand_json_value(&doc, round % 7 == 0 ? 6 : 0);
+		int len = strbuf_length(&doc);
+		char *text = malloc(len + 1);
+		strbuf_to_string(&doc, text);
+		rjson_engines_check(text, len, &slr, &index);
+		free(text);
+	}
+	// not a single well-formed value, the index engine gives it to SLR
+	const char *invalids[] = {"truex", "[1] [2]", "{\"a\": [true]}false", "", "  "};
+	for (int i = 0; i < ARRAYSIZE(invalids); i++)
+		rjson_engines_check((char *)invalids[i], (int)strlen(invalids[i]), &slr, &index);
+	strbuf_release(&doc);
+	wcsbuf_release(&slr);
+	wcsbuf_release(&index);
+}
+
+void t_rjson_parser()
+{
+	struct rjson_parser parser;
+	// deeply nested, the stream grows beyond rstream.cached
+	int depth = 5000;
+	char *text = malloc(depth * 2 + 1);
+	for (int i = 0; i < depth; i++) {
+		text[i] = '[';
+		text[depth * 2 - 1 - i] = ']';
+	}
+	text[depth * 2] = 0;
+	rjson_parser_init(&parser, L"deep", text, depth * 2);
+	rjson_parser_read(&parser);
+	struct rjson_value *value = parser.json.value;
+	int n = 0;
+	while (value && value->kind == KArray) {
+		n++;
+		value = value->length ? rjvalue_array_get(value, 0) : NULL;
+	}
+	assert(n == depth);
+	assert(parser.stream.base != parser.stream.cached);
+	rjson_parser_release(&parser);
+	free(text);
+
+	// token tape, the block is smaller than the number of tokens
+	char json[] = "{\"a\": [1, -2.5e3, true, false, null], \"b\": {\"c\": \"\\\"str\\\"\"}, \"d\": []}";
+	for (int block = 0; block <= 64; block += 3) {
+		rjson_parser_init(&parser, L"tape", json, (int)strlen(json));
+		rstream_tape(&parser.stream, block);
+		rjson_parser_read(&parser);
+		struct rjson_value *a = rjvalue_object_get(parser.json.value, L"a");
+		assert(a->kind == KArray && a->length == 5);
+		assert(rjvalue_array_get(a, 1)->number == -2500.);
+		assert(rjvalue_array_get(a, 2)->istrue && rjvalue_array_get(a, 4)->kind == KNull);
+		assert(wcscmp(rjvalue_object_get(parser.json.value, L"b.c")->string, L"\"str\"") == 0);
+		assert(rjvalue_object_get(parser.json.value, L"d")->length == 0);
+		rjson_parser_release(&parser);
+	}
+	// escapes, "\\" is one backslash and the unknown ones(e.g. "\u") are kept as is
+	char escapes[] = "[\"a\\\\\", \"\\\\n\", \"\\u0041\\t\"]";
+	rjson_parser_init(&parser, L"escapes", escapes, (int)strlen(escapes));
+	rjson_parser_read(&parser);
+	assert(parser.json.value->length == 3);
+	assert(wcscmp(rjvalue_array_get(parser.json.value, 0)->string, L"a\\") == 0);
+	assert(wcscmp(rjvalue_array_get(parser.json.value, 1)->string, L"\\n") == 0);
+	assert(wcscmp(rjvalue_array_get(parser.json.value, 2)->string, L"\\u0041\t") == 0);
+	rjson_parser_release(&parser);
+	// numbers are read in place, compare with strtod
+	const char *numbers[] = {
+		"0", "7", "0.5", ".25", "3.", "1e10", "2.5E-3", "123456789", "9007199254740993",
+		"18446744073709551615", "0.000001234", "1.7976931348623157e308", "2.2250738585072014e-308",
+		"4.9e-324", "1e400", "1e-400", "123.456e-7", "0.1", "3.141592653589793238462643383279502884197",
+		"12345678901234567890123456789012345678901234567890e-30", "100000000000000000000000",
+	};
+	for (int i = 0; i < ARRAYSIZE(numbers); i++) {
+		char text[128];
+		int n = sprintf(text, "[%s, -%s]", numbers[i], numbers[i]);
+		rjson_parser_init(&parser, L"number", text, n);
+		rjson_parser_read(&parser);
+		double expect = strtod(numbers[i], NULL);
+		assert(rjvalue_as_number(rjvalue_array_get(parser.json.value, 0)) == expect);
+		assert(rjvalue_as_number(rjvalue_array_get(parser.json.value, 1)) == -expect);
+		rjson_parser_release(&parser);
+	}
+	// exact integers beyond 2^53, the literal with fraction or exponent is still KNumber
+	char ints[] = "[9007199254740993, -9223372036854775808, 9223372036854775807, 9223372036854775808, 1.0, 1e2, -0]";
+	rjson_parser_init(&parser, L"integer", ints, (int)strlen(ints));
+	rjson_parser_read(&parser);
+	struct rjson_value *ia = parser.json.value;
+	assert(rjvalue_array_get(ia, 0)->kind == KInteger && rjvalue_array_get(ia, 0)->integer == 9007199254740993LL);
+	assert(rjvalue_array_get(ia, 1)->kind == KInteger && rjvalue_array_get(ia, 1)->integer == INT64_MIN);
+	assert(rjvalue_array_get(ia, 2)->kind == KInteger && rjvalue_array_get(ia, 2)->integer == INT64_MAX);
+	assert(rjvalue_array_get(ia, 3)->kind == KNumber && rjvalue_array_get(ia, 3)->number == 9223372036854775808.);
+	assert(rjvalue_as_integer(rjvalue_array_get(ia, 3)) == INT64_MAX);
+	assert(rjvalue_as_integer(rjvalue_number(&parser.json, -1e300)) == INT64_MIN);
+	assert(rjvalue_as_integer(rjvalue_number(&parser.json, INFINITY)) == INT64_MAX);
+	assert(rjvalue_as_integer(rjvalue_number(&parser.json, NAN)) == 0);
+	assert(rjvalue_as_integer(rjvalue_number(&parser.json, -2.9)) == -2);
+	assert(rjvalue_array_get(ia, 4)->kind == KNumber && rjvalue_as_integer(rjvalue_array_get(ia, 4)) == 1);
+	assert(rjvalue_array_get(ia, 5)->kind == KNumber && rjvalue_array_get(ia, 5)->number == 100.);
+	assert(rjvalue_array_get(ia, 6)->kind == KInteger && rjvalue_array_get(ia, 6)->integer == 0);
+	assert(rjvalue_array_get(rjvalue_array_get(ia, 0), 0) == NULL); // KInteger isn't a container
+	struct wcsbuf ibuf;
+	wcsbuf_init(&ibuf);
+	rjvalue_string(&ibuf, rjvalue_array_get(ia, 1), -1);
+	wchar_t iwcs[32];
+	wcsbuf_to_string(&ibuf, iwcs);
+	assert(wcscmp(iwcs, L"-9223372036854775808\n") == 0);
+	wcsbuf_release(&ibuf);
+	rjson_parser_release(&parser);
+	// push-style parsing, the document is given in pieces of every size
+	char doc[] = "// head\r\n{\"a\": [1, -2.5e3, 12345678901234, true, false, null], /* block\n * comment */"
+		"\"b\" : {\"c\": \"\\\"s\\\\tr\\\"\", \"\xE4\xB8\xAD\": \"\\n\"},\r\n\t\"d\": [[], {}]}  ";
+	int doclen = (int)strlen(doc);
+	struct wcsbuf expect_dump, dump;
+	wcsbuf_init(&expect_dump);
+	wcsbuf_init(&dump);
+	rjson_parser_init(&parser, L"whole", doc, doclen);
+	rjson_parser_read(&parser);
+	rjson_parser_dump(&parser, &expect_dump);
+	rjson_parser_release(&parser);
+	wchar_t *expect_wcs = malloc((wcsbuf_length(&expect_dump) + 1) * sizeof(wchar_t));
+	wchar_t *dump_wcs = malloc((wcsbuf_length(&expect_dump) + 1) * sizeof(wchar_t));
+	wcsbuf_to_string(&expect_dump, expect_wcs);
+	for (int piece = 1; piece <= doclen; piece++) {
+		rjson_parser_init(&parser, L"feed", NULL, 0);
+		rstream_tape(&parser.stream, piece % 3 ? 0 : 4);
+		int done = 0;
+		for (int i = 0; i < doclen && !done; i += piece)
+			done = rjson_parser_feed(&parser, doc + i, doclen - i < piece ? doclen - i : piece);
+		if (!done)
+			done = rjson_parser_feed(&parser, NULL, 0);
+		assert(done && parser.json.value);
+		rjson_parser_dump(&parser, &dump);
+		assert(wcsbuf_length(&dump) == wcsbuf_length(&expect_dump));
+		wcsbuf_to_string(&dump, dump_wcs);
+		assert(wcscmp(dump_wcs, expect_wcs) == 0);
+		assert(parser.wincap <= 1024);
+		rjson_parser_release(&parser);
+	}
+	// the file is mapped and lexed in place
+	FILE *jsonfile = fopen("rjson_test.json", "wb");
+	fwrite(doc, 1, doclen, jsonfile);
+	fclose(jsonfile);
+	assert(rjson_parse_file(&parser, "rjson_test.json"));
+	rjson_parser_dump(&parser, &dump);
+	wcsbuf_to_string(&dump, dump_wcs);
+	assert(wcscmp(dump_wcs, expect_wcs) == 0);
+	rjson_parser_release(&parser);
+	remove("rjson_test.json");
+	assert(rjson_parse_file(&parser, "rjson_test.json") == 0);
+	free(expect_wcs);
+	free(dump_wcs);
+	wcsbuf_release(&expect_dump);
+	wcsbuf_release(&dump);
+	// SAX events are the same as DOM, and no node is allocated
+	struct wcsbuf sax_out, dom_out;
+	wcsbuf_init(&sax_out);
+	wcsbuf_init(&dom_out);
+	struct rjson_sax sax = {
+		.ud = &sax_out,
+		.begin_object = sax_begin_object,
+		.end_object = sax_end_object,
+		.begin_array = sax_begin_array,
+		.end_array = sax_end_array,
+		.on_key = sax_on_key,
+		.on_string = sax_on_string,
+		.on_number = sax_on_number,
+		.on_integer = sax_on_integer,
+		.on_bool = sax_on_bool,
+		.on_null = sax_on_null,
+	};
+	rjson_parser_init(&parser, L"sax", doc, doclen);
+	rjson_parser_sax(&parser, &sax);
+	assert(parser.json.nodepool.base.chunk_head == NULL);
+	rjson_parser_release(&parser);
+	rjson_parser_init(&parser, L"dom", doc, doclen);
+	rjson_parser_read(&parser);
+	sax_of_dom(&dom_out, parser.json.value);
+	rjson_parser_release(&parser);
+	int sax_len = wcsbuf_length(&sax_out);
+	assert(sax_len == wcsbuf_length(&dom_out) && sax_len > 0);
+	wchar_t *sax_wcs = malloc((sax_len + 1) * 2 * sizeof(wchar_t));
+	wcsbuf_to_string(&sax_out, sax_wcs);
+	wcsbuf_to_string(&dom_out, sax_wcs + sax_len + 1);
+	assert(wcscmp(sax_wcs, sax_wcs + sax_len + 1) == 0);
+	free(sax_wcs);
+	wcsbuf_release(&sax_out);
+	wcsbuf_release(&dom_out);
+	// a number at the end of input is done by rjson_parser_feed(parser, NULL, 0)
+	rjson_parser_init(&parser, L"feed", NULL, 0);
+	assert(rjson_parser_feed(&parser, "12", 2) == 0);
+	assert(rjson_parser_feed(&parser, "34", 2) == 0);
+	assert(rjson_parser_feed(&parser, NULL, 0) == 1);
+	assert(parser.json.value->kind == KInteger && parser.json.value->integer == 1234);
+	rjson_parser_release(&parser);
+	// long string bodies and indentation, the escapes are at every offset of 16 bytes stride
+	char pretty[2048];
+	wchar_t expect[64];
+	for (int k = 0; k < 40; k++) {
+		int n = sprintf(pretty, "{\r\n\t    \"key\"  :\r\n        \"");
+		int e = 0;
+		for (int i = 0; i < k; i++) {
+			pretty[n++] = 'a' + i % 26;
+			expect[e++] = 'a' + i % 26;
+		}
+		n += sprintf(pretty + n, "\\t\xE4\xB8\xAD" "0123456789abcdefghij\\\"\"\n}");
+		const wchar_t *tail = L"\t\x4E2D" L"0123456789abcdefghij\"";
+		while ((expect[e++] = *tail++));
+		rjson_parser_init(&parser, L"pretty", pretty, n);
+		rjson_parser_read(&parser);
+		struct rjson_value *key = rjvalue_object_get(parser.json.value, L"key");
+		assert(key && key->kind == KString && wcscmp(key->string, expect) == 0);
+		rjson_parser_release(&parser);
+	}
+	// trivia doesn't use the stack
+	int lines = 100000;
+	const char *trivia = "  // comment\r\n\t/* block\n */ \n";
+	int tlen = (int)strlen(trivia);
+	text = malloc(tlen * lines + 8);
+	for (int i = 0; i < lines; i++)
+		memcpy(text + i * tlen, trivia, tlen);
+	strcpy(text + tlen * lines, "[1, 2]");
+	rjson_parser_init(&parser, L"trivia", text, (int)strlen(text));
+	rjson_parser_read(&parser);
+	assert(parser.json.value->kind == KArray && parser.json.value->length == 2);
+	rjson_parser_release(&parser);
+	free(text);
+}
+
 void pmap_test(int n); // test/pmap_test.c
 
 int main(int argc, char** args) {
@@ -598,7 +1393,11 @@ int main(int argc, char** args) {
 	t_strbuf();
 	t_wcsbuf();
 	t_rarray();
+	t_crlf();
+	t_rope();
 	t_rjson();
+	t_rjson_parser();
+	t_rjson_engines();
 	pmap_test(3);
 	for (int i = 0; i < 7; i++) {
 		t_tinyalloc();
@@ -19,11 +19,15 @@ struct chunk {
 void crlf_init(struct crlf_counter *crlf)
 {
 	strbuf_init((struct strbuf *)crlf);
+	crlf->source = NULL;
+	crlf->pending = 0;
 }
 
 void crlf_release(struct crlf_counter *crlf)
 {
 	strbuf_release((struct strbuf *)crlf);
+	crlf->source = NULL;
+	crlf->pending = 0;
 }
 
 static void crlf_append_new(struct crlf_counter *crlf, int pos)
@@ -59,42 +63,282 @@ void crlf_add(struct crlf_counter *crlf, int pos)
 	crlf_append_new(crlf, pos);
 }
 
-static int crlf_index2addr(struct chunk *chk, int index, int **addr)
+void crlf_lazy(struct crlf_counter *crlf, const void *source, int len, int charsize)
 {
-	if (!chk)
-		return index;
-	index = crlf_index2addr(chk_next(chk), index, addr);
-	if (index >= 0) {
-		if (index >= chk->len)
-			return index - chk->len;
-		*addr = &chk->data[index];
+	crlf->source = source;
+	crlf->srclen = len;
+	crlf->charsize = charsize;
+	crlf->pending = 1;
+}
+
+/*
+ * Scans '\n' by memchr which is vectorized by the C runtime,
+ * for UCS2(little-endian) only the hits at even offset followed by '\0' are '\n'
+ */
+static void crlf_scan(struct crlf_counter *crlf)
+{
+	const char *src = crlf->source;
+	const int size = crlf->charsize;
+	const char *ptr = src;
+	const char *max = src + crlf->srclen * size;
+	crlf->pending = 0;
+	while ((ptr = memchr(ptr, '\n', max - ptr))) {
+		int offset = (int)(ptr - src);
+		ptr++;
+		if (size == 2 && ((offset & 1) || ptr == max || *ptr))
+			continue;
+		crlf_add(crlf, offset / size + 1);
 	}
-	return -1;
 }
 
-static int crlf_pos(struct crlf_counter *crlf, int index) {
-	int *pos = NULL;
-	crlf_index2addr(chk_head(crlf), index, &pos);
-	return pos ? *pos : 0;
+// Merges all chunks into one, so that index => position is O(1). Returns NULL if out of memory
+static struct chunk *crlf_flatten(struct crlf_counter *crlf)
+{
+	struct chunk *chk = chk_head(crlf);
+	if (!chk || !chk_next(chk))
+		return chk;
+	int size = crlf->length + crlf->csize;
+	struct chunk *flat = rb_malloc(sizeof(struct chunk) + size * sizeof(int));
+	if (!flat)
+		return NULL;
+	flat->len = size;
+	flat->pos = crlf->length;
+	chk_next(flat) = NULL;
+	int *ptr = flat->data + crlf->length;
+	while (chk) { // newest first
+		struct chunk *next = chk_next(chk);
+		ptr -= chk->pos;
+		memcpy(ptr, chk->data, chk->pos * sizeof(int));
+		rb_free(chk);
+		chk = next;
+	}
+	chk_head(crlf) = flat;
+	return flat;
 }
 
-struct lncolumn crlf_get(struct crlf_counter *crlf, int pos)
+// index => position by walking the chunks(newest first), used if crlf_flatten() is out of memory
+static int crlf_chunked(struct crlf_counter *crlf, int index)
+{
+	int end = crlf->length;
+	for (struct chunk *chk = chk_head(crlf); chk; chk = chk_next(chk)) {
+		end -= chk->pos;
+		if (index >= end)
+			return chk->data[index - end];
+	}
+	return 0;
+}
+
+#define crlf_at(crlf, data, index) ((data) ? (data)[index] : crlf_chunked(crlf, index))
+
+// bsearch, the number of line starts <= pos, "data" is the flat array or NULL
+static int crlf_rank(struct crlf_counter *crlf, const int *data, int pos)
 {
-	// bsearch
 	int i = 0;
-	int j = crlf->length - 1;
-	while (i <= j) {
+	int j = crlf->length;
+	while (i < j) {
 		int k = (i + j) >> 1;
-		int p = crlf_pos(crlf, k);
-		if (pos < p) {
-			j = k - 1;
+		if (crlf_at(crlf, data, k) <= pos) {
+			i = k + 1;
 		} else {
+			j = k;
+		}
+	}
+	return i;
+}
+
+struct lncolumn crlf_get(struct crlf_counter *crlf, int pos)
+{
+	if (crlf->pending)
+		crlf_scan(crlf);
+	struct chunk *chk = crlf_flatten(crlf);
+	const int *data = chk ? chk->data : NULL;
+	int i = crlf_rank(crlf, data, pos);
+	if (i == 0)
+		return (struct lncolumn){.line = 1, .column = pos + 1};
+	return (struct lncolumn){.line = i, .column = pos - crlf_at(crlf, data, i - 1) + 1};
+}
+
+struct posidx {
+	int pos;
+	int index;
+};
+
+static int posidx_cmp(const void *a, const void *b)
+{
+	const struct posidx *pa = a;
+	const struct posidx *pb = b;
+	return pa->pos < pb->pos ? -1 : pa->pos > pb->pos;
+}
+
+// the number of code points in [ptr, ptr + len)
+static int utf8_count(const unsigned char *ptr, int len)
+{
+	int n = 0;
+	for (int i = 0; i < len; i++)
+		n += (ptr[i] & 0xC0) != 0x80;
+	return n;
+}
+
+// the columns in [start, pos), in code points for the part covered by "utf8"
+static int crlf_columns(const unsigned char *utf8, int srclen, int start, int pos)
+{
+	int max = pos < srclen ? pos : srclen;
+	if (start < max)
+		return utf8_count(utf8 + start, max - start) + (pos - max);
+	return pos - start;
+}
+
+// Resolves each position by bsearch, used if the positions are unsorted and out of memory
+static void crlf_get_each(struct crlf_counter *crlf, const int *data, const unsigned char *utf8, int srclen,
+	const int positions[], int n, struct lncolumn out[])
+{
+	for (int i = 0; i < n; i++) {
+		int pos = positions[i];
+		if (pos < 0) {
+			out[i] = (struct lncolumn){.line = 1, .column = pos + 1};
+			continue;
+		}
+		int k = crlf_rank(crlf, data, pos);
+		int base = k ? crlf_at(crlf, data, k - 1) : 0;
+		out[i] = (struct lncolumn){.line = k ? k : 1, .column = crlf_columns(utf8, srclen, base, pos) + 1};
+	}
+}
+
+void crlf_get_many(struct crlf_counter *crlf, const int positions[], int n, struct lncolumn out[])
+{
+	if (crlf->pending)
+		crlf_scan(crlf);
+	struct chunk *chk = crlf_flatten(crlf);
+	const int *data = chk ? chk->data : NULL;
+	const int length = crlf->length;
+	const unsigned char *utf8 = crlf->source && crlf->charsize == 1 ? crlf->source : NULL;
+	const int srclen = utf8 ? crlf->srclen : 0;
+
+	struct posidx *order = NULL;
+	for (int i = 1; i < n; i++) {
+		if (positions[i] >= positions[i - 1])
+			continue;
+		order = rb_malloc(n * sizeof(struct posidx));
+		if (!order) {
+			crlf_get_each(crlf, data, utf8, srclen, positions, n, out);
+			return;
+		}
+		for (int j = 0; j < n; j++)
+			order[j] = (struct posidx){positions[j], j};
+		qsort(order, n, sizeof(struct posidx), posidx_cmp);
+		break;
+	}
+	int k = 0;      // the number of line starts <= pos
+	int start = 0;  // the start of current line
+	int last = 0;   // the previous position in current line
+	int column = 0; // the columns in [start, last)
+	for (int i = 0; i < n; i++) {
+		int j = order ? order[i].index : i;
+		int pos = positions[j];
+		if (pos < 0) {
+			out[j] = (struct lncolumn){.line = 1, .column = pos + 1};
+			continue;
+		}
+		while (k < length && crlf_at(crlf, data, k) <= pos)
+			k++;
+		int base = k ? crlf_at(crlf, data, k - 1) : 0;
+		if (base != start || pos < last) {
+			start = base;
+			last = base;
+			column = 0;
+		}
+		column += crlf_columns(utf8, srclen, last, pos);
+		last = pos;
+		out[j] = (struct lncolumn){.line = k ? k : 1, .column = column + 1};
+	}
+	rb_free(order);
+}
+
+/**
+*
+* delta-compressed variant
+*
+*/
+struct crlf_skip {
+	int pos;    // the first position of block
+	int offset; // the varint deltas of block in bytes
+};
+
+void crlf_packed_init(struct crlf_packed *crlf)
+{
+	crlf->length = 0;
+	crlf->last = 0;
+	rarray_init(&crlf->bytes, sizeof(unsigned char));
+	rarray_init(&crlf->skips, sizeof(struct crlf_skip));
+}
+
+void crlf_packed_release(struct crlf_packed *crlf)
+{
+	rarray_release(&crlf->bytes);
+	rarray_release(&crlf->skips);
+	crlf->length = 0;
+	crlf->last = 0;
+}
+
+void crlf_packed_add(struct crlf_packed *crlf, int pos)
+{
+	if (crlf->length++ % CRLF_PACKED_BLOCK == 0) {
+		struct crlf_skip skip = {pos, rarray_len(&crlf->bytes)};
+		rarray_push(&crlf->skips, &skip);
+		crlf->last = pos;
+		return;
+	}
+	unsigned int delta = pos - crlf->last;
+	int len = rarray_len(&crlf->bytes);
+	if (len + 5 > rarray_cap(&crlf->bytes))
+		rarray_grow(&crlf->bytes, (len + 5) * 2);
+	unsigned char *base = (unsigned char *)crlf->bytes.base;
+	unsigned char *ptr = base + len;
+	while (delta >= 0x80) {
+		*ptr++ = (unsigned char)(delta | 0x80);
+		delta >>= 7;
+	}
+	*ptr++ = (unsigned char)delta;
+	rarray_setlen(&crlf->bytes, (int)(ptr - base));
+	crlf->last = pos;
+}
+
+struct lncolumn crlf_packed_get(struct crlf_packed *crlf, int pos)
+{
+	// bsearch, the number of blocks which starts <= pos
+	const struct crlf_skip *skips = (struct crlf_skip *)crlf->skips.base;
+	int i = 0;
+	int j = rarray_len(&crlf->skips);
+	while (i < j) {
+		int k = (i + j) >> 1;
+		if (skips[k].pos <= pos) {
 			i = k + 1;
-			if (k < j && pos >= crlf_pos(crlf, i)) {
-				continue;
-			}
-			return (struct lncolumn){.line = i, .column = pos - p + 1};
+		} else {
+			j = k;
 		}
 	}
-	return (struct lncolumn){.line = 1, .column = pos + 1};
+	if (i == 0)
+		return (struct lncolumn){.line = 1, .column = pos + 1};
+	// then decodes the deltas of block
+	int index = (i - 1) * CRLF_PACKED_BLOCK;
+	int end = index + CRLF_PACKED_BLOCK;
+	if (end > crlf->length)
+		end = crlf->length;
+	int start = skips[i - 1].pos;
+	const unsigned char *ptr = (unsigned char *)crlf->bytes.base + skips[i - 1].offset;
+	while (++index < end) {
+		unsigned int delta = 0;
+		int shift = 0;
+		unsigned char c;
+		do {
+			c = *ptr++;
+			delta |= (unsigned int)(c & 0x7F) << shift;
+			shift += 7;
+		} while (c & 0x80);
+		if (start + (int)delta > pos)
+			break;
+		start += delta;
+	}
+	// "index" is the number of positions <= pos
+	return (struct lncolumn){.line = index + 1, .column = pos - start + 1};
 }
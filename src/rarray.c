@@ -3,36 +3,71 @@
  */
 
 #include "rarray.h"
-
-struct rarray_head {
-	int len;
-	int cap;
-	char data[0];
-};
+#ifdef _MSC_VER
+#	include <intrin.h>
+#endif
 
 #define hd_to_base(head)     ((prarray_base)(head)->data)
-#define hd_from_base(base)   (container_of(((void *)(base)), struct rarray_head, data))
+#define hd_from_base(base)   rarray_head_of(base)
 
 static void phead_realloc(struct rarray *prar, int cap, int len)
 {
 	struct rarray_head *head = prar->base ? hd_from_base(prar->base) : NULL;
-	head = ra_realloc(head, sizeof(struct rarray_head) + prar->size * cap);
+	if (head && (head->flags & RARRAY_INLINE)) {
+		if (cap <= head->cap) {
+			head->len = len;
+			return;
+		}
+		// spills to heap
+		struct rarray_head *heap = ra_realloc(NULL, sizeof(struct rarray_head) + prar->size * cap);
+		memcpy(heap->data, head->data, prar->size * (len < head->len ? len : head->len));
+		head->len = 0;
+		head = heap;
+	} else {
+		head = ra_realloc(head, sizeof(struct rarray_head) + prar->size * cap);
+	}
 	head->cap = cap;
 	head->len = len;
+	head->flags = 0;
 	prar->base = hd_to_base(head);
 }
 
+// Make sure "cap >= need" by doubling
+static struct rarray_head *phead_reserve(struct rarray *prar, int need)
+{
+	int cap = prar->base ? hd_from_base(prar->base)->cap : 0;
+	if (need > cap) {
+		cap = cap * 2 > need ? cap * 2 : need;
+		cap = cap < 16 ? 16 : ALIGN_POW2(cap, 8);
+		phead_realloc(prar, cap, rarray_len(prar));
+	}
+	return hd_from_base(prar->base);
+}
+
 void rarray_init(struct rarray *prar, int elemsize)
 {
 	prar->size = elemsize;
 	prar->base = NULL;
 }
 
+void rarray_init_inline(struct rarray *prar, int elemsize, struct rarray_head *head, int n)
+{
+	head->len = 0;
+	head->cap = n;
+	head->flags = RARRAY_INLINE;
+	prar->size = elemsize;
+	prar->base = hd_to_base(head);
+}
+
 void rarray_release(struct rarray *prar)
 {
 	if (!prar->base)
 		return;
 	struct rarray_head *head = hd_from_base(prar->base);
+	if (head->flags & RARRAY_INLINE) {
+		head->len = 0;
+		return;
+	}
 	ra_free(head);
 	prar->base = NULL;
 }
@@ -121,3 +156,158 @@ void rarray_set(struct rarray *prar, int index, void *value)
 	struct rarray_head *head = hd_from_base(prar->base);
 	memcpy(head->data + (index * prar->size), value, prar->size);
 }
+
+int rarray_push_n(struct rarray *prar, void *values, int n)
+{
+	if (n <= 0)
+		return rarray_len(prar);
+	struct rarray_head *head = phead_reserve(prar, rarray_len(prar) + n);
+	if (values)
+		memcpy(head->data + head->len * prar->size, values, n * prar->size);
+	head->len += n;
+	return head->len;
+}
+
+void rarray_insert_range(struct rarray *prar, int index, void *values, int n)
+{
+	int len = rarray_len(prar);
+	if (n <= 0 || index < 0 || index > len)
+		return;
+	struct rarray_head *head = phead_reserve(prar, len + n);
+	char *ptr = head->data + index * prar->size;
+	memmove(ptr + n * prar->size, ptr, (len - index) * prar->size);
+	if (values)
+		memcpy(ptr, values, n * prar->size);
+	head->len += n;
+}
+
+void rarray_erase_range(struct rarray *prar, int index, int n)
+{
+	int len = rarray_len(prar);
+	if (index < 0 || index >= len || n <= 0)
+		return;
+	if (n > len - index)
+		n = len - index;
+	struct rarray_head *head = hd_from_base(prar->base);
+	char *ptr = head->data + index * prar->size;
+	memmove(ptr, ptr + n * prar->size, (len - index - n) * prar->size);
+	head->len -= n;
+}
+
+void rarray_sort(struct rarray *prar, int (*cmp)(const void *, const void *))
+{
+	int len = rarray_len(prar);
+	if (len > 1)
+		qsort(prar->base, len, prar->size, cmp);
+}
+
+int rarray_lower_bound(struct rarray *prar, const void *key, int (*cmp)(const void *, const void *))
+{
+	const char *data = (const char *)prar->base;
+	int i = 0;
+	int j = rarray_len(prar);
+	while (i < j) {
+		int k = (i + j) >> 1;
+		if (cmp(data + k * prar->size, key) < 0) {
+			i = k + 1;
+		} else {
+			j = k;
+		}
+	}
+	return i;
+}
+
+/**
+*
+* segmented array
+*
+*/
+#define SEG_BASE           (1u << RARRAY_SEG_SHIFT)
+#define SEG_BLOCKS(seg)    ((int)ARRAYSIZE((seg)->blocks))
+
+static inline int seg_msb(unsigned int x)
+{
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanReverse(&i, x);
+	return (int)i;
+#else
+	return 31 - __builtin_clz(x);
+#endif
+}
+
+// index => (block, offset) in O(1)
+static inline char *seg_addr(struct rarray_seg *seg, int index)
+{
+	unsigned int i = (unsigned int)index + SEG_BASE;
+	int msb = seg_msb(i);
+	return seg->blocks[msb - RARRAY_SEG_SHIFT] + (i - (1u << msb)) * seg->size;
+}
+
+void rarray_seg_init(struct rarray_seg *seg, int elemsize)
+{
+	seg->len = 0;
+	seg->size = elemsize;
+	for (int i = 0; i < SEG_BLOCKS(seg); i++)
+		seg->blocks[i] = NULL;
+}
+
+void rarray_seg_release(struct rarray_seg *seg)
+{
+	for (int i = 0; i < SEG_BLOCKS(seg); i++) {
+		ra_free(seg->blocks[i]);
+		seg->blocks[i] = NULL;
+	}
+	seg->len = 0;
+}
+
+int rarray_seg_setlen(struct rarray_seg *seg, int len)
+{
+	if (len < 0)
+		return -1;
+	if (len > seg->len) {
+		int last = seg_msb((unsigned int)(len - 1) + SEG_BASE) - RARRAY_SEG_SHIFT;
+		for (int k = 0; k <= last; k++) {
+			if (seg->blocks[k])
+				continue;
+			seg->blocks[k] = ra_realloc(NULL, (SEG_BASE << k) * seg->size);
+			if (!seg->blocks[k])
+				return -1; // the blocks already allocated are kept for the next call
+		}
+	}
+	seg->len = len;
+	return 0;
+}
+
+void *rarray_seg_push(struct rarray_seg *seg, void *value)
+{
+	int index = seg->len;
+	if (rarray_seg_setlen(seg, index + 1))
+		return NULL;
+	char *ptr = seg_addr(seg, index);
+	memcpy(ptr, value, seg->size);
+	return ptr;
+}
+
+void *rarray_seg_pop(struct rarray_seg *seg)
+{
+	if (seg->len == 0)
+		return NULL;
+	return seg_addr(seg, --seg->len);
+}
+
+void *rarray_seg_get(struct rarray_seg *seg, int index)
+{
+	if (index < 0 || index >= seg->len)
+		return NULL;
+	return seg_addr(seg, index);
+}
+
+void rarray_seg_set(struct rarray_seg *seg, int index, void *value)
+{
+	if (index < 0)
+		return;
+	if (index >= seg->len && rarray_seg_setlen(seg, index + 1))
+		return;
+	memcpy(seg_addr(seg, index), value, seg->size);
+}
@@ -5,7 +5,10 @@
 
 #define INT_DIV_WCHAR          (sizeof(int) / sizeof(wchar_t))
 #define rj_lenwcs_new(rj, n)   bumpalloc(&rj->wcspool, (n) * sizeof(wchar_t))
+#define rj_lenwcs_shrink(rj, lwcs, n, newn) \
+	bumpshrink(&rj->wcspool, lwcs, (n) * sizeof(wchar_t), (newn) * sizeof(wchar_t))
 #define rj_vitem_new(rj)       fixedalloc(&rj->nodepool)
+#define is_container(v)        ((v)->kind == KObject || (v)->kind == KArray)
 
 rj_wchars rj_wchars_fromwcs(struct rjson *rj, wchar_t *src, int len)
 {
@@ -22,11 +25,14 @@ rj_wchars rj_wchars_fromwcs(struct rjson *rj, wchar_t *src, int len)
 rj_wchars rj_wchars_fromstr(struct rjson *rj, char *src, int len)
 {
 	if (len < 0)
-		len = utf8towcs(NULL, (unsigned char *)src, -1) - 1; // without '\0'
-	struct lwchars *lwcs = rj_lenwcs_new(rj, len + (1 + INT_DIV_WCHAR));
-	lwcs->len = len;
-	utf8towcs(lwcs->wcs, (unsigned char *)src, len);
-	lwcs->wcs[len] = 0;
+		len = strlen(src); // in bytes
+	// decodes in one pass into the worst-case sized block, then gives back the unused tail
+	int size = UTF8TOWCS_BOUND(len) + (1 + INT_DIV_WCHAR);
+	struct lwchars *lwcs = rj_lenwcs_new(rj, size);
+	int wlen = utf8towcs(lwcs->wcs, (unsigned char *)src, len);
+	lwcs->len = wlen;
+	lwcs->wcs[wlen] = 0;
+	rj_lenwcs_shrink(rj, lwcs, size, wlen + (1 + INT_DIV_WCHAR));
 	return lwcs->wcs;
 }
 
@@ -42,6 +48,30 @@ rj_wchars rj_wchars_flush(struct rjson *rj, struct wcsbuf *buffer)
 	return lwcs->wcs;
 }
 
+rj_wchars rj_wchars_reserve(struct rjson *rj, int len)
+{
+	struct lwchars *lwcs = rj_lenwcs_new(rj, len + (1 + INT_DIV_WCHAR));
+	if (!lwcs)
+		return NULL;
+	lwcs->len = len;
+	return lwcs->wcs;
+}
+
+rj_wchars rj_wchars_commit(struct rjson *rj, rj_wchars wcs, int len)
+{
+	struct lwchars *lwcs = LWCHARS_OF(wcs);
+	rj_lenwcs_shrink(rj, lwcs, lwcs->len + (1 + INT_DIV_WCHAR), len + (1 + INT_DIV_WCHAR));
+	lwcs->len = len;
+	lwcs->wcs[len] = 0;
+	return wcs;
+}
+
+void rj_wchars_free(struct rjson *rj, rj_wchars wcs)
+{
+	struct lwchars *lwcs = LWCHARS_OF(wcs);
+	rj_lenwcs_shrink(rj, lwcs, lwcs->len + (1 + INT_DIV_WCHAR), 0);
+}
+
 rj_wchars rj_wchars_alloc(struct rjson *rj, int len)
 {
 	struct lwchars *lwcs = rj_lenwcs_new(rj, len + (1 + sizeof(int) / sizeof(wchar_t)));
@@ -93,6 +123,35 @@ struct rjson_value *rjvalue_number(struct rjson *rj, double number)
 	return &vitem->value;
 }
 
+struct rjson_value *rjvalue_integer(struct rjson *rj, int64_t integer)
+{
+	struct rjson_vitem *vitem = rj_vitem_new(rj);
+	vitem->value.kind = KInteger;
+	vitem->value.integer = integer;
+	vitem->next = NULL;
+	return &vitem->value;
+}
+
+double rjvalue_as_number(struct rjson_value *value)
+{
+	if (value->kind == KInteger)
+		return (double)value->integer;
+	return value->kind == KNumber ? value->number : 0.;
+}
+
+int64_t rjvalue_as_integer(struct rjson_value *value)
+{
+	if (value->kind == KInteger)
+		return value->integer;
+	if (value->kind != KNumber || value->number != value->number) // NaN
+		return 0;
+	if (value->number >= 9223372036854775808.)
+		return INT64_MAX;
+	if (value->number < -9223372036854775808.)
+		return INT64_MIN;
+	return (int64_t)value->number;
+}
+
 struct rjson_value *rjvalue_object_new(struct rjson *rj)
 {
 	struct rjson_vitem *vitem = rj_vitem_new(rj);
@@ -140,7 +199,7 @@ struct rjson_value *rjvalue_from_lwchars(struct rjson *rj, struct lwchars *lwcs)
 // Adds `child` at the end.
 void rjvalue_object_add(struct rjson_value *object, struct rjson_vitem *child)
 {
-	if (object->kind < KObject)
+	if (!is_container(object))
 		return;
 	child->next = NULL;
 	if (object->head == NULL)
@@ -154,7 +213,7 @@ void rjvalue_object_add(struct rjson_value *object, struct rjson_vitem *child)
 // Adds `child` at the beginning.
 void rjvalue_object_push(struct rjson_value *object, struct rjson_vitem *child)
 {
-	if (object->kind < KObject)
+	if (!is_container(object))
 		return;
 	child->next = object->head;
 	object->head = child;
@@ -168,7 +227,7 @@ void rjvalue_object_push(struct rjson_value *object, struct rjson_vitem *child)
 
 struct rjson_value *rjvalue_array_get(struct rjson_value *array, int index)
 {
-	if (array->kind < KObject)
+	if (!is_container(array))
 		return NULL;
 	struct rjson_vitem *vitem = rjvalue_first(array);
 	int i = 0;
@@ -264,6 +323,7 @@ const static wchar_t *wcstabs[] = {
 #define ADD_STRING(ws, len)    wcsbuf_append_string(buffer, ws, len)
 #define ADD_CHAR(c)            wcsbuf_append_char(buffer, c)
 #define ADD_NUMBER(n)          wcsbuf_append_double(buffer, n, -1)
+#define ADD_INTEGER(i)         wcsbuf_append_int64(buffer, i)
 
 static void add_with_unescape(struct wcsbuf *buffer, wchar_t *wcs, int len)
 {
@@ -306,6 +366,9 @@ static void output_compact(struct wcsbuf *buffer, struct rjson_value *value)
 	case KNumber:
 		ADD_NUMBER(value->number);
 		break;
+	case KInteger:
+		ADD_INTEGER(value->integer);
+		break;
 	case KString:
 		ADD_CHAR('"');
 		add_with_unescape(buffer, value->string, rj_wchars_length(value->string));
@@ -360,6 +423,9 @@ static void output_normal(struct wcsbuf *buffer, struct rjson_value *value, int
 	case KNumber:
 		ADD_NUMBER(value->number);
 		break;
+	case KInteger:
+		ADD_INTEGER(value->integer);
+		break;
 	case KString:
 		ADD_CHAR('"');
 		add_with_unescape(buffer, value->string, rj_wchars_length(value->string));
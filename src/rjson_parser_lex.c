@@ -1,7 +1,26 @@
 // Generated by haxelib lex
+// NOTE: _entry is patched by hand to loop on lex_goto, see LEX_ENTRY_LOOPS
 #define LEXCHAR unsigned char
 #define rlex_char(lex, i)     (((LEXCHAR *)(lex)->src)[i])
 #define rlex_current(lex)     (((LEXCHAR *)(lex)->src) + (lex)->pos.min)
+/*
+ * NOTE: lex_goto() returns a negative value from an action, which the generator template
+ * doesn't handle, so _entry() is patched by hand in rjson_parser_lex.c to loop back
+ * into the scanner and must be re-applied after regenerating:
+ *
+ *	#define LEX_ENTRY_LOOPS 1 // before "static int _entry("
+ *	static int _entry(struct rlex* lex, int begin) {
+ *		while (1) {
+ *			... // the generated body, but "return _cases(lex, q);" becomes:
+ *			int ret = _cases(lex, q);
+ *			if (ret >= 0)
+ *				return ret;
+ *			begin = -1 - ret; // lex_goto(begin)
+ *		}
+ *	}
+ *
+ * the lexer fails to compile without LEX_ENTRY_LOOPS
+ */
 #include "rjson.h"
 
 enum token {
@@ -21,13 +40,12 @@ enum token {
 };
 
 #define lto_parser(ptr)      container_of(ptr, struct rjson_parser, lex)
-#define lto_buffer(lex)      (&lto_parser(lex)->json.buffer)
-#define lto_crlfcnt(lex)     (&lto_parser(lex)->crlfcnt)
 
 #define lpmin(lex)           ((lex)->pos.min)
 #define lpmax(lex)           ((lex)->pos.max)
 
-#define buffer_reset(p)      wcsbuf_reset(&(p)->json.buffer)
+// Loops back into _entry with "begin" instead of a recursive call, only for the last expression of action
+#define lex_goto(begin)      (-1 - (begin))
 
 int copy_lexchars(struct rlex *lex, int pos, int len, wchar_t *out, int outlen)
 {
@@ -47,21 +65,131 @@ int copy_lexchars(struct rlex *lex, int pos, int len, wchar_t *out, int outlen)
 #endif
 }
 
-static void copy_lexchars_to_buffer(struct rlex *lex, int pos, int len, struct wcsbuf *buffer)
+// Decodes [pos, pos + len) to the end of parser->string
+static void string_append(struct rlex *lex, int pos, int len)
 {
+	struct rjson_parser *parser = lto_parser(lex);
 	LEXCHAR *source = ((LEXCHAR *)lex->src) + pos;
 #if LEXCHAR_UCS2
-	wcsbuf_append_string(buffer, source, len);
+	wmemcpy(parser->string + parser->strpos, source, len);
+	parser->strpos += len;
 #else
-	int dstlen = utf8towcs(NULL, source, len);
-	if (len < 0)
-		dstlen--;  // without '\0'
-	VLADecl(wchar_t, dest, dstlen + 1);
-	utf8towcs(dest, source, len);
-	wcsbuf_append_string(buffer, dest, dstlen);
+	parser->strpos += utf8towcs(parser->string + parser->strpos, source, len);
 #endif
 }
 
+#define string_putc(lex, c)  (lto_parser(lex)->string[lto_parser(lex)->strpos++] = (c))
+
+#if !LEXCHAR_UCS2 && !defined(RJSON_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#	define LEX_SSE2 1
+#	include <emmintrin.h>
+#	ifdef _MSC_VER
+#		include <intrin.h>
+#	endif
+static inline int lex_ctz(unsigned int x)
+{
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanForward(&i, x);
+	return (int)i;
+#else
+	return __builtin_ctz(x);
+#endif
+}
+#endif
+
+// Returns the position of the first '"', '\\' or control character from "i"
+int lex_span_string(const LEXCHAR *src, int i, int size)
+{
+#if LEX_SSE2
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i slash = _mm_set1_epi8('\\');
+	const __m128i ctrl = _mm_set1_epi8(0x1F);
+	while (i + 16 <= size) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, slash));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v)); // v <= 0x1F
+		int mask = _mm_movemask_epi8(m);
+		if (mask)
+			return i + lex_ctz(mask);
+		i += 16;
+	}
+#endif
+	while (i < size) {
+		LEXCHAR c = src[i];
+		if (c == '"' || c == '\\' || c < 0x20)
+			break;
+		i++;
+	}
+	return i;
+}
+
+// Returns the position of the first non-whitespace or lone '\r' from "i"
+static int lex_span_spaces(const LEXCHAR *src, int i, int size)
+{
+	int j = i;
+#if LEX_SSE2
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i cr = _mm_set1_epi8('\r');
+	while (j + 16 <= size) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + j));
+		__m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab));
+		m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)));
+		int mask = _mm_movemask_epi8(m) ^ 0xFFFF;
+		if (mask) {
+			j += lex_ctz(mask);
+			goto Exit;
+		}
+		j += 16;
+	}
+#endif
+	while (j < size) {
+		LEXCHAR c = src[j];
+		if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+			break;
+		j++;
+	}
+#if LEX_SSE2
+Exit:
+#endif
+	// "\r" must be followed by "\n"
+	for (; i < j; i++) {
+		if (src[i] == '\r' && (i + 1 == size || src[i + 1] != '\n'))
+			return i;
+	}
+	return j;
+}
+
+// Returns the position of closing '"' from "i", or "size" if unclosed
+int lex_string_end(const LEXCHAR *src, int i, int size)
+{
+	while ((i = lex_span_string(src, i, size)) < size) {
+		if (src[i] == '"')
+			return i;
+		i += src[i] == '\\' ? 2 : 1;
+	}
+	return size;
+}
+
+// Skips the rest of whitespace after the current token
+static inline void skip_spaces(struct rlex *lex)
+{
+	lpmax(lex) = lex_span_spaces(lex->src, lpmax(lex), lex->size);
+}
+
+// Decodes the string body up to the next '"', '\\' or control character, so the DFA only sees them
+static inline void skip_string_body(struct rlex *lex)
+{
+	int i = lpmax(lex);
+	int j = lex_span_string(lex->src, i, lex->size);
+	if (j == i)
+		return;
+	string_append(lex, i, j - i);
+	lpmax(lex) = j;
+}
+
 // For template variables, please check CLexer.Config
 
 const static unsigned  char  _lextable[] = {
@@ -410,20 +538,21 @@ static int _cases(struct rlex* lex, int _q) {
 
 	case 0:
 	{
-		crlf_add(lto_crlfcnt(lex), lpmax(lex));
-		_ret = (token());
+		skip_spaces(lex);
+		_ret = (lex_goto(TOKEN_BEGIN));
 	}
 	break;
 
 	case 1:
 	{
-		_ret = (token());
+		skip_spaces(lex);
+		_ret = (lex_goto(TOKEN_BEGIN));
 	}
 	break;
 
 	case 2:
 	{
-		_ret = (token());
+		_ret = (lex_goto(TOKEN_BEGIN));
 	}
 	break;
 
@@ -496,23 +625,30 @@ static int _cases(struct rlex* lex, int _q) {
 	case 14:
 	{
 		blkcomment();
-		_ret = (token());
+		_ret = (lex_goto(TOKEN_BEGIN));
 	}
 	break;
 
 	case 15:
 	{
 		struct rjson_parser *parser = lto_parser(lex);
-		buffer_reset(parser);
 		int min = lpmin(lex);
+		// the decoded length <= the source length
+		int len = lex_string_end(lex->src, lpmax(lex), lex->size) - lpmax(lex);
+		parser->string = rj_wchars_reserve(&parser->json, len);
+		if (!parser->string) {
+			fprintf(stderr, "Out of Memory: %d characters\n", len);
+			exit(-1);
+		}
+		parser->strpos = 0;
+		skip_string_body(lex);
 		enum token tok = tstring();
 		if (tok == Eof) {
 		fprintf(stderr, "UnClosed String: %d-%d", min, lpmax(lex));
 		exit(-1);
 		}
 		lpmin(lex) = min;
-		rj_wchars wcs = rj_wchars_flush(&parser->json, NULL);
-		rarray_push(&parser->parray, &((struct pos_wchars){.pos = min, .wcs = wcs}));
+		lex->value = rj_wchars_commit(&parser->json, parser->string, parser->strpos);
 		_ret = (tok);
 	}
 	break;
@@ -525,14 +661,13 @@ static int _cases(struct rlex* lex, int _q) {
 
 	case 17:
 	{
-		_ret = (blkcomment());
+		_ret = (lex_goto(BLKCOMMENT_BEGIN));
 	}
 	break;
 
 	case 18:
 	{
-		crlf_add(lto_crlfcnt(lex), lpmax(lex));
-		_ret = (blkcomment());
+		_ret = (lex_goto(BLKCOMMENT_BEGIN));
 	}
 	break;
 
@@ -544,43 +679,52 @@ static int _cases(struct rlex* lex, int _q) {
 
 	case 20:
 	{
-		wcsbuf_append_char(lto_buffer(lex), '\n');
-		_ret = (tstring());
+		string_putc(lex, '\n');
+		skip_string_body(lex);
+		_ret = (lex_goto(TSTRING_BEGIN));
 	}
 	break;
 
 	case 21:
 	{
-		wcsbuf_append_char(lto_buffer(lex), '\r');
-		_ret = (tstring());
+		string_putc(lex, '\r');
+		skip_string_body(lex);
+		_ret = (lex_goto(TSTRING_BEGIN));
 	}
 	break;
 
 	case 22:
 	{
-		wcsbuf_append_char(lto_buffer(lex), '\t');
-		_ret = (tstring());
+		string_putc(lex, '\t');
+		skip_string_body(lex);
+		_ret = (lex_goto(TSTRING_BEGIN));
 	}
 	break;
 
 	case 23:
 	{
-		wcsbuf_append_char(lto_buffer(lex), '"');
-		_ret = (tstring());
+		string_putc(lex, '"');
+		skip_string_body(lex);
+		_ret = (lex_goto(TSTRING_BEGIN));
 	}
 	break;
 
 	case 24:
 	{
-		wcsbuf_append_char(lto_buffer(lex), '\\');
-		_ret = (tstring());
+		// "\\" is an escaped backslash, the others(e.g. "\u") are kept as is
+		if (lpmax(lex) < lex->size && rlex_char(lex, lpmax(lex)) == '\\')
+			lpmax(lex)++;
+		string_putc(lex, '\\');
+		skip_string_body(lex);
+		_ret = (lex_goto(TSTRING_BEGIN));
 	}
 	break;
 
 	case 25:
 	{
-		copy_lexchars_to_buffer(lex, lpmin(lex), rlex_cursize(lex), lto_buffer(lex));
-		_ret = (tstring());
+		string_append(lex, lpmin(lex), rlex_cursize(lex));
+		skip_string_body(lex);
+		_ret = (lex_goto(TSTRING_BEGIN));
 	}
 	break;
 
@@ -610,39 +754,45 @@ static int _cases(struct rlex* lex, int _q) {
 #undef tstring
 
 
+#define LEX_ENTRY_LOOPS 1 // patched by hand, see the top of rjson_parser.lex
 static int _entry(struct rlex* lex, int begin) {
-	if (rlex_end(lex)) {
-		lex->pos.min = lex->pos.max;
-		return Eof;
-	}
-	int c;
-	int i = lex->pos.max;
-	int state = begin;
-	int prev = begin;
-	while(i < lex->size) {
-		c = rlex_char(lex, i++);
-
-		if (c > 127)
-			c = 127;
-
-		state = LEX_TRANS(state, c);
-		if (state >= 35)
-			break;
-		prev = state;
-	}
-	lex->pos.min = i; // if UnMatached then pmin >= pmax
-	if (state == 255) {
-		state = prev;
-		i--;
-	}
-	int q = LEX_EXIT(state);
-	if (i > lex->pos.max && q < 26) {
-		lex->pos.min = lex->pos.max;
-		lex->pos.max = i;
-	} else {
-		q = LEX_EXIT(begin);
+	while (1) {
+		if (rlex_end(lex)) {
+			lex->pos.min = lex->pos.max;
+			return Eof;
+		}
+		int c;
+		int i = lex->pos.max;
+		int state = begin;
+		int prev = begin;
+		while(i < lex->size) {
+			c = rlex_char(lex, i++);
+
+			if (c > 127)
+				c = 127;
+
+			state = LEX_TRANS(state, c);
+			if (state >= 35)
+				break;
+			prev = state;
+		}
+		lex->pos.min = i; // if UnMatached then pmin >= pmax
+		if (state == 255) {
+			state = prev;
+			i--;
+		}
+		int q = LEX_EXIT(state);
+		if (i > lex->pos.max && q < 26) {
+			lex->pos.min = lex->pos.max;
+			lex->pos.max = i;
+		} else {
+			q = LEX_EXIT(begin);
+		}
+		int ret = _cases(lex, q);
+		if (ret >= 0)
+			return ret;
+		begin = -1 - ret; // lex_goto(begin)
 	}
-	return _cases(lex, q);
 }
 static int __token(struct rlex* lex) {
 	return _entry(lex, 0 );
@@ -654,5 +804,10 @@ void rjson_parser_init_lexeme(struct rlex* lex, LEXCHAR *src, int size) {
 	lex->size = size;
 	lex->src = src;
 	lex->token = __token;
+	lex->value = NULL;
 }
  // lexer end
+
+#ifndef LEX_ENTRY_LOOPS
+#	error "_entry isn't patched for lex_goto, see the top of rjson_parser.lex"
+#endif
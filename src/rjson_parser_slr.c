@@ -1,4 +1,5 @@
 // Generated by haxelib lex
+// NOTE: slrloop is patched by hand to suspend on RSTREAM_PENDING, see SLRLOOP_SUSPENDS
 #define LEXCHAR unsigned char
 #define rlex_char(lex, i)     (((LEXCHAR *)(lex)->src)[i])
 #define rlex_current(lex)     (((LEXCHAR *)(lex)->src) + (lex)->pos.min)
@@ -19,51 +20,177 @@ enum token {
 	OpSub = 12,
 };
 
+/*
+ * NOTE: rjson_parser_feed() needs the slrloop to suspend on the RSTREAM_PENDING lookahead,
+ * which the generator template doesn't produce, so it's patched by hand in rjson_parser_slr.c
+ * and must be re-applied after regenerating:
+ *
+ *	#define SLRLOOP_SUSPENDS 1 // before "void *rjson_parser_slrloop("
+ *	...
+ *		t = rstream_next(stream);
+ *		if (t->term == RSTREAM_PENDING) { // suspends, see rstream_suspended()
+ *			stream->head -= 1;
+ *			rstream_junk(stream, 1);
+ *			return NULL;
+ *		}
+ *
+ * rjson_parser_feed() fails to compile without SLRLOOP_SUSPENDS
+ */
+#include <limits.h>
 #include "rjson.h"
+#ifdef _WIN32
+#	define WIN32_LEAN_AND_MEAN
+#	include <windows.h>
+#else
+#	include <fcntl.h>
+#	include <unistd.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#endif
 
 // from rjson_parser.lex
 int copy_lexchars(struct rlex *lex, int pos, int len, wchar_t *out, int outlen);
+int lex_span_string(const LEXCHAR *src, int i, int size);
+int lex_string_end(const LEXCHAR *src, int i, int size);
 
-static int pos_wchars_compare (const void * a, const void * b)
+#define sto_parser(s)         container_of(s, struct rjson_parser, stream)
+#define tpmin(t)              (t)->pos.min
+#define tpmax(t)              (t)->pos.max
+
+// The number token without sign, "digits" is the mantissa if it has no more than 19 significant digits
+struct number_scan {
+	uint64_t digits;
+	int exp10;
+	int truncated; // has more than 19 significant digits
+	int integer;   // no fraction and exponent
+	int len;
+	const LEXCHAR *source;
+};
+
+#define is_digit(c)           ((c) >= '0' && (c) <= '9')
+#define MANTISSA_DIGITS       19
+
+static void number_scan(const LEXCHAR *ptr, const LEXCHAR *max, struct number_scan *out)
 {
-	return ((struct pos_wchars *)a)->pos - ((struct pos_wchars *)b)->pos;
+	out->source = ptr;
+	out->len = (int)(max - ptr);
+	uint64_t digits = 0;
+	int n = 0; // significant digits
+	int exp10 = 0;
+	int truncated = 0;
+	for (; ptr < max && is_digit(*ptr); ptr++) {
+		if (n < MANTISSA_DIGITS) {
+			digits = digits * 10 + (*ptr - '0');
+			n += digits != 0;
+		} else {
+			exp10++;
+			truncated |= *ptr != '0';
+		}
+	}
+	out->integer = ptr == max;
+	if (ptr < max && *ptr == '.') {
+		for (ptr++; ptr < max && is_digit(*ptr); ptr++) {
+			if (n < MANTISSA_DIGITS) {
+				digits = digits * 10 + (*ptr - '0');
+				n += digits != 0;
+				exp10--;
+			} else {
+				truncated |= *ptr != '0';
+			}
+		}
+	}
+	if (ptr < max && (*ptr == 'e' || *ptr == 'E')) {
+		ptr++;
+		int neg = ptr < max && *ptr == '-';
+		if (ptr < max && (*ptr == '-' || *ptr == '+'))
+			ptr++;
+		int e = 0;
+		for (; ptr < max && is_digit(*ptr); ptr++) {
+			if (e < 100000)
+				e = e * 10 + (*ptr - '0');
+		}
+		exp10 += neg ? -e : e;
+	}
+	out->digits = digits;
+	out->exp10 = exp10;
+	out->truncated = truncated;
 }
 
-static void copy_to_chars(const LEXCHAR *source, int len, char *out, int outlen)
+// Falls back to strtod with the decimal point of current locale
+static double number_slow(const LEXCHAR *source, int len)
 {
-	if (len > outlen)
-		len = outlen - 1;
-	int i = 0;
-	while (i < len) {
-		out[i] = (unsigned char)source[i];
-		i++;
+	char point = localeconv()->decimal_point[0];
+	VLADecl(char, tmp, len + 1);
+	for (int i = 0; i < len; i++)
+		tmp[i] = source[i] == '.' ? point : (char)source[i];
+	tmp[len] = 0;
+	return strtod(tmp, NULL);
+}
+
+// 1e0 ~ 1e22 are exact in double
+static const double pow10_exact[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// The result is exact if the mantissa <= 2^53 and |exp10| <= 22 (Clinger's fast path)
+static double number_to_double(const struct number_scan *num)
+{
+	if (num->digits == 0)
+		return 0.;
+	if (!num->truncated && num->digits <= ((uint64_t)1 << 53)) {
+		double d = (double)num->digits;
+		if (num->exp10 == 0)
+			return d;
+		if (num->exp10 > 0 && num->exp10 <= 22)
+			return d * pow10_exact[num->exp10];
+		if (num->exp10 < 0 && num->exp10 >= -22)
+			return d / pow10_exact[-num->exp10];
 	}
-	out[len] = 0;
+	return number_slow(num->source, num->len);
 }
 
-#define sto_parser(s)         container_of(s, struct rjson_parser, stream)
-#define tpmin(t)              (t)->pos.min
-#define tpmax(t)              (t)->pos.max
+// Reads the token in place
+static struct number_scan number_of_string(struct rstream *stream, const struct rstream_tok *t)
+{
+	struct number_scan num;
+	const LEXCHAR *source = (const LEXCHAR *)stream->lex->src + tpmin(t);
+	number_scan(source, source + (tpmax(t) - tpmin(t)), &num);
+	return num;
+}
 
-static double double_of_string(struct rstream *stream, const struct rstream_tok *t)
+// Returns 1 and "*integer" if the literal is an integer in int64 range, otherwise 0 and "*number"
+static int number_value(const struct number_scan *num, int neg, int64_t *integer, double *number)
 {
-	char tmp[32];
-	int len = tpmax(t) - tpmin(t);
-	const LEXCHAR *source = stream->lex->src;
-	copy_to_chars(source + tpmin(t), len, tmp, ARRAYSIZE(tmp));
-	return strtod(tmp, NULL);
+	if (num->integer && !num->truncated && num->exp10 == 0) {
+		if (!neg && num->digits <= (uint64_t)INT64_MAX) {
+			*integer = (int64_t)num->digits;
+			return 1;
+		}
+		if (neg && num->digits <= (uint64_t)INT64_MAX + 1) {
+			*integer = (int64_t)(0 - num->digits);
+			return 1;
+		}
+	}
+	double d = number_to_double(num);
+	*number = neg ? -d : d;
+	return 0;
+}
+
+// KInteger if the literal is an integer in int64 range, otherwise KNumber
+static struct rjson_value *rjvalue_of_number(struct rjson *rj, const struct number_scan *num, int neg)
+{
+	int64_t integer;
+	double number;
+	if (number_value(num, neg, &integer, &number))
+		return rjvalue_integer(rj, integer);
+	return rjvalue_number(rj, number);
 }
 
 static rj_wchars wcs_of_string(struct rstream *stream, const struct rstream_tok *t)
 {
-	struct rarray *parray = &sto_parser(stream)->parray;
-	struct pos_wchars *pwcs = &((struct pos_wchars){.pos = tpmin(t), .wcs = NULL});
-	pwcs = bsearch(pwcs, parray->base, rarray_len(parray), sizeof(struct pos_wchars), pos_wchars_compare);
-	if (pwcs == NULL) {
-		fprintf(stderr, "some thing is wrong! %d-%d\n", tpmin(t), tpmax(t));
-		exit(-1);
-	}
-	return pwcs->wcs;
+	(void)stream;
+	return t->value; // decoded by lexer
 }
 
 static struct rjson_value *rjvalue_merge(struct rjson_value *parent, const struct rjson_value *reverses)
@@ -191,8 +318,8 @@ static void *slrcases(struct rstream *stream, int _q) {
 	case 5:
 	{
 		const struct rstream_tok *T1 = stream_offset(-1);
-		const double f = double_of_string(stream, T1);
-		_ret = (void *)(size_t)(rjvalue_number(RJSON, f));
+		const struct number_scan f = number_of_string(stream, T1);
+		_ret = (void *)(size_t)(rjvalue_of_number(RJSON, &f, 0));
 	}
 	break;
 
@@ -200,8 +327,8 @@ static void *slrcases(struct rstream *stream, int _q) {
 	{
 		const struct rstream_tok *T1 = stream_offset(-2);
 		const struct rstream_tok *T2 = stream_offset(-1);
-		const double f = double_of_string(stream, T2);
-		_ret = (void *)(size_t)(rjvalue_number(RJSON, -f));
+		const struct number_scan f = number_of_string(stream, T2);
+		_ret = (void *)(size_t)(rjvalue_of_number(RJSON, &f, 1));
 	}
 	break;
 
@@ -312,6 +439,7 @@ static void *slrcases(struct rstream *stream, int _q) {
 }
 
 // public function
+#define SLRLOOP_SUSPENDS 1 // patched by hand, see the top of rjson_parser.slr
 void *rjson_parser_slrloop(struct rstream *stream, int state, int exp)
 {
 #define NRULES          17
@@ -331,6 +459,11 @@ void *rjson_parser_slrloop(struct rstream *stream, int state, int exp)
 	int q = INVALID;
 	while (1) { FirstLoop:
 		t = rstream_next(stream);
+		if (t->term == RSTREAM_PENDING) { // suspends, see rstream_suspended()
+			stream->head -= 1;
+			rstream_junk(stream, 1);
+			return NULL;
+		}
 		state = SLR_TRANS(state, t->term);
 		if (state >= NSEGS)
 			break;
@@ -389,11 +522,13 @@ void rjson_parser_init(struct rjson_parser *parser, wchar_t *filename, LEXCHAR *
 	// buffer, wcspool, nodepool, value
 	rjson_init(&parser->json);
 
-	// pos => string map init
-	parser->parray = (struct rarray){.size = sizeof(struct pos_wchars), .base = NULL};
+	// the string being decoded by lexer
+	parser->string = NULL;
+	parser->strpos = 0;
 
-	// crlf counter init
+	// crlf counter init, the line index is built from "text" only if crlf_get() is called
 	parser->crlfcnt = (struct crlf_counter){.csize = 128, .length = 0, .chunks = NULL};
+	crlf_lazy(&parser->crlfcnt, text, len, sizeof(LEXCHAR));
 
 	// filename, could be L""
 	parser->filename = rj_wchars_fromwcs(&parser->json, filename, -1);
@@ -403,17 +538,841 @@ void rjson_parser_init(struct rjson_parser *parser, wchar_t *filename, LEXCHAR *
 
 	// stream
 	rstream_init(&parser->stream, &parser->lex);
+
+	// rjson_parser_read
+	parser->engine = RJSON_ENGINE_SLR;
+
+	// rjson_parser_feed
+	parser->window = NULL;
+	parser->winlen = 0;
+	parser->wincap = 0;
+	parser->scanned = 0;
+	parser->safe = 0;
+	parser->scan = 0;
 }
 
 void rjson_parser_release(struct rjson_parser *parser)
 {
 	rjson_release(&parser->json); // buffer, wcspool, nodepool
-	rarray_release(&parser->parray);
 	crlf_release(&parser->crlfcnt);
+	rstream_release(&parser->stream);
+	free(parser->window);
+	parser->window = NULL;
 	parser->lex.src = NULL;
 }
 
+/*
+ * Structural index engine, see RJSON_ENGINE_INDEX
+ *
+ * Stage 1 classifies 64 characters at a time into bitmasks, then the escaped characters, the inside of strings
+ * and the first character of scalars are derived by integer operations, the positions of structural characters,
+ * opening quotes and scalars outside of strings are saved to an index.
+ * Stage 2 builds the DOM by walking the index without the lexer.
+ */
+#if !LEXCHAR_UCS2 && !defined(RJSON_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#	define INDEX_SSE2 1
+#	include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#	include <intrin.h>
+#endif
+
+#define INDEX_BLOCK           64
+
+struct index_masks {
+	uint64_t backslash;
+	uint64_t quote;
+	uint64_t space;  // ' ', '\t', '\n', '\r'
+	uint64_t op;     // '{', '}', '[', ']', ':', ','
+	uint64_t slash;  // '/', the comment is unsupported
+};
+
+static inline int index_ctz64(uint64_t x)
+{
+#ifdef _MSC_VER
+	unsigned long i;
+	if ((uint32_t)x) {
+		_BitScanForward(&i, (uint32_t)x);
+		return (int)i;
+	}
+	_BitScanForward(&i, (uint32_t)(x >> 32));
+	return (int)i + 32;
+#else
+	return __builtin_ctzll(x);
+#endif
+}
+
+static void index_classify(const LEXCHAR *src, struct index_masks *m)
+{
+	*m = (struct index_masks){0};
+#if INDEX_SSE2
+#	define EQ(v, c)   _mm_cmpeq_epi8(v, _mm_set1_epi8(c))
+#	define MASK(v, i) ((uint64_t)(uint32_t)_mm_movemask_epi8(v) << ((i) * 16))
+	for (int i = 0; i < INDEX_BLOCK / 16; i++) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i * 16));
+		__m128i space = _mm_or_si128(_mm_or_si128(EQ(v, ' '), EQ(v, '\t')), _mm_or_si128(EQ(v, '\n'), EQ(v, '\r')));
+		__m128i op = _mm_or_si128(_mm_or_si128(EQ(v, '{'), EQ(v, '}')), _mm_or_si128(EQ(v, '['), EQ(v, ']')));
+		op = _mm_or_si128(op, _mm_or_si128(EQ(v, ':'), EQ(v, ',')));
+		m->backslash |= MASK(EQ(v, '\\'), i);
+		m->quote |= MASK(EQ(v, '"'), i);
+		m->space |= MASK(space, i);
+		m->op |= MASK(op, i);
+		m->slash |= MASK(EQ(v, '/'), i);
+	}
+#	undef EQ
+#	undef MASK
+#else
+	for (int i = 0; i < INDEX_BLOCK; i++) {
+		uint64_t bit = (uint64_t)1 << i;
+		switch (src[i]) {
+		case '\\':
+			m->backslash |= bit;
+			break;
+		case '"':
+			m->quote |= bit;
+			break;
+		case ' ': case '\t': case '\n': case '\r':
+			m->space |= bit;
+			break;
+		case '{': case '}': case '[': case ']': case ':': case ',':
+			m->op |= bit;
+			break;
+		case '/':
+			m->slash |= bit;
+			break;
+		default:
+			break;
+		}
+	}
+#endif
+}
+
+// The characters which follow an odd sequence of backslashes, "*carry" is 1 if the next block starts escaped
+static inline uint64_t index_escaped(uint64_t backslash, uint64_t *carry)
+{
+	const uint64_t even = 0x5555555555555555ULL;
+	backslash &= ~*carry;
+	uint64_t follows = backslash << 1 | *carry;
+	uint64_t odd_starts = backslash & ~even & ~follows;
+	uint64_t even_starts = odd_starts + backslash; // the sequences which start at odd bits are cleared
+	*carry = even_starts < backslash;
+	return (even ^ (even_starts << 1)) & follows;
+}
+
+// bit i = xor of bits [0, i]
+static inline uint64_t index_prefix_xor(uint64_t x)
+{
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+// Stage 1, sets the bit of every structural position into "bits"(one word per block), returns -1 if there are comments
+static int index_build(const LEXCHAR *src, int len, uint64_t *bits)
+{
+	LEXCHAR tail[INDEX_BLOCK];
+	uint64_t escape_carry = 0;
+	uint64_t in_string_carry = 0; // all 1 if the previous block ends inside a string
+	uint64_t scalar_carry = 0;
+	for (int base = 0; base < len; base += INDEX_BLOCK) {
+		const LEXCHAR *block = src + base;
+		if (len - base < INDEX_BLOCK) {
+			int rest = len - base;
+			memcpy(tail, block, rest * sizeof(LEXCHAR));
+			for (int i = rest; i < INDEX_BLOCK; i++)
+				tail[i] = ' ';
+			block = tail;
+		}
+		struct index_masks m;
+		index_classify(block, &m);
+		uint64_t quote = m.quote & ~index_escaped(m.backslash, &escape_carry);
+		// includes the opening quote but not the closing one
+		uint64_t in_string = index_prefix_xor(quote) ^ in_string_carry;
+		in_string_carry = 0 - (in_string >> 63);
+		if (m.slash & ~in_string)
+			return -1;
+		uint64_t scalar = ~(m.space | m.op | quote | in_string);
+		*bits++ = (m.op & ~in_string) | (quote & in_string) | (scalar & ~(scalar << 1 | scalar_carry));
+		scalar_carry = scalar >> 63;
+	}
+	return 0;
+}
+
+RARRAY_DEFINE(index_stack, struct rjson_value *)
+
+struct index_walker {
+	struct rjson_parser *parser;
+	const LEXCHAR *src;
+	int len;
+	const uint64_t *bits;
+	int nwords;
+	int word;     // the word of "cur"
+	uint64_t cur; // the bits of word which are not visited yet
+};
+
+// Returns the next position in index, or "len" if it's the end
+static inline int index_next(struct index_walker *w)
+{
+	while (w->cur == 0) {
+		if (++w->word >= w->nwords)
+			return w->len;
+		w->cur = w->bits[w->word];
+	}
+	int pos = w->word * INDEX_BLOCK + index_ctz64(w->cur);
+	w->cur &= w->cur - 1;
+	return pos;
+}
+
+// Decodes the string at "pos" by the same rules as the lexer, returns NULL if it's unclosed or has control characters
+static rj_wchars index_string(struct index_walker *w, int pos)
+{
+	const LEXCHAR *src = w->src;
+	int i = pos + 1;
+	int end = lex_string_end(src, i, w->len);
+	if (end >= w->len)
+		return NULL;
+	struct rjson *rj = &w->parser->json;
+	rj_wchars wcs = rj_wchars_reserve(rj, end - i);
+	if (!wcs) {
+		fprintf(stderr, "Out of Memory: %d characters\n", end - i);
+		exit(-1);
+	}
+	int k = 0;
+	while (1) {
+		int j = lex_span_string(src, i, end);
+#if LEXCHAR_UCS2
+		wmemcpy(wcs + k, src + i, j - i);
+		k += j - i;
+#else
+		k += utf8towcs(wcs + k, src + i, j - i);
+#endif
+		if (j == end)
+			break;
+		if (src[j] != '\\')
+			return NULL;
+		switch (src[j + 1]) {
+		case 'n': wcs[k++] = '\n'; i = j + 2; break;
+		case 'r': wcs[k++] = '\r'; i = j + 2; break;
+		case 't': wcs[k++] = '\t'; i = j + 2; break;
+		case '"': wcs[k++] = '"'; i = j + 2; break;
+		case '\\': wcs[k++] = '\\'; i = j + 2; break;
+		default: wcs[k++] = '\\'; i = j + 1; break; // e.g. "\u" is kept as is
+		}
+	}
+	return rj_wchars_commit(rj, wcs, k);
+}
+
+static inline int index_scalar_char(LEXCHAR c)
+{
+	switch (c) {
+	case ' ': case '\t': case '\n': case '\r': case '"': case '/':
+	case '{': case '}': case '[': case ']': case ':': case ',':
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+// Same as the lexer: "0" | "[1-9][0-9]*" | "[0-9]+.[0-9]*" | ".[0-9]+", then an optional exponent
+static int index_number_check(const LEXCHAR *p, const LEXCHAR *max)
+{
+	const LEXCHAR *start = p;
+	while (p < max && is_digit(*p))
+		p++;
+	int digits = (int)(p - start);
+	if (p < max && *p == '.') {
+		const LEXCHAR *frac = ++p;
+		while (p < max && is_digit(*p))
+			p++;
+		if (digits == 0 && p == frac)
+			return 0;
+	} else if (digits == 0 || (digits > 1 && *start == '0')) {
+		return 0;
+	}
+	if (p < max && (*p == 'e' || *p == 'E')) {
+		p++;
+		if (p < max && (*p == '+' || *p == '-'))
+			p++;
+		const LEXCHAR *exp = p;
+		while (p < max && is_digit(*p))
+			p++;
+		if (p == exp)
+			return 0;
+	}
+	return p == max;
+}
+
+static int index_keyword(const LEXCHAR *p, int len, const char *word)
+{
+	int i = 0;
+	while (i < len && word[i] && p[i] == (LEXCHAR)word[i])
+		i++;
+	return i == len && word[i] == 0;
+}
+
+// Returns NULL if it isn't a keyword or number of the lexer
+static struct rjson_value *index_scalar(struct index_walker *w, int pos)
+{
+	const LEXCHAR *src = w->src;
+	int neg = src[pos] == '-';
+	if (neg && (pos + 1 == w->len || !index_scalar_char(src[pos + 1])))
+		pos = index_next(w); // "-" is a token of lexer, e.g. "- 1"
+	else if (neg)
+		pos++;
+	int end = pos;
+	while (end < w->len && index_scalar_char(src[end]))
+		end++;
+	struct rjson *rj = &w->parser->json;
+	if (!neg) {
+		if (index_keyword(src + pos, end - pos, "true"))
+			return rjvalue_bool(rj, 1);
+		if (index_keyword(src + pos, end - pos, "false"))
+			return rjvalue_bool(rj, 0);
+		if (index_keyword(src + pos, end - pos, "null"))
+			return rjvalue_null(rj);
+	}
+	if (pos >= w->len || !index_number_check(src + pos, src + end))
+		return NULL;
+	struct number_scan num;
+	number_scan(src + pos, src + end, &num);
+	return rjvalue_of_number(rj, &num, neg);
+}
+
+/*
+ * Stage 2, returns 0 if the document isn't a single well-formed value, e.g. "truex", "[1,]" or trailing tokens,
+ * then the SLR engine decides what to do with it
+ */
+static int index_walk(struct index_walker *w, struct rjson_value **out)
+{
+	const LEXCHAR *src = w->src;
+	struct rjson *rj = &w->parser->json;
+	struct rjson_value *root = NULL;
+	struct index_stack stack;
+	index_stack_init(&stack);
+	rj_wchars key = NULL; // the key of next value if the top of stack is KObject
+	int pos = index_next(w);
+	if (pos == w->len)
+		goto Fail;
+	while (1) {
+		// value
+		struct rjson_value *value;
+		int open = 0;
+		switch (src[pos]) {
+		case '{':
+			value = rjvalue_object_new(rj);
+			open = 1;
+			break;
+		case '[':
+			value = rjvalue_array_new(rj);
+			open = 1;
+			break;
+		case '"': {
+			rj_wchars wcs = index_string(w, pos);
+			if (!wcs)
+				goto Fail;
+			value = rjvalue_from_lwchars(rj, LWCHARS_OF(wcs));
+			break;
+		}
+		default:
+			value = index_scalar_char(src[pos]) ? index_scalar(w, pos) : NULL;
+			if (!value)
+				goto Fail;
+			break;
+		}
+		int depth = index_stack_len(&stack);
+		if (depth) {
+			VITEM_OF(value)->key = key;
+			rjvalue_object_add(stack.base[depth - 1], VITEM_OF(value));
+		} else {
+			root = value;
+		}
+		key = NULL;
+		if (open) {
+			index_stack_push(&stack, value);
+			pos = index_next(w);
+			if (pos < w->len && src[pos] == (value->kind == KObject ? '}' : ']')) {
+				index_stack_pop(&stack);
+			} else if (value->kind == KArray) {
+				if (pos == w->len)
+					goto Fail;
+				continue;
+			} else {
+				goto Key;
+			}
+		}
+		// the end of value, closes the containers
+		while (1) {
+			depth = index_stack_len(&stack);
+			if (depth == 0)
+				goto Exit;
+			struct rjson_value *top = stack.base[depth - 1];
+			pos = index_next(w);
+			if (pos == w->len)
+				goto Fail;
+			if (src[pos] == ',') {
+				pos = index_next(w);
+				if (pos == w->len)
+					goto Fail;
+				if (top->kind == KArray)
+					break;
+				goto Key;
+			}
+			if (src[pos] != (top->kind == KObject ? '}' : ']'))
+				goto Fail;
+			index_stack_pop(&stack);
+		}
+		continue;
+	Key:
+		if (pos == w->len || src[pos] != '"')
+			goto Fail;
+		key = index_string(w, pos);
+		if (!key)
+			goto Fail;
+		pos = index_next(w);
+		if (pos == w->len || src[pos] != ':')
+			goto Fail;
+		pos = index_next(w);
+		if (pos == w->len)
+			goto Fail;
+	}
+Exit:
+	index_stack_release(&stack);
+	if (index_next(w) != w->len)
+		return 0;
+	*out = root;
+	return 1;
+Fail:
+	index_stack_release(&stack);
+	return 0;
+}
+
+// Drops the partial tree of index_walk(), "parser->json" has nothing but the filename before rjson_parser_read()
+static void index_discard(struct rjson_parser *parser)
+{
+	int len = rj_wchars_length(parser->filename);
+	VLADecl(wchar_t, filename, len + 1);
+	wmemcpy(filename, parser->filename, len);
+	rjson_release(&parser->json);
+	rjson_init(&parser->json);
+	parser->filename = rj_wchars_fromwcs(&parser->json, filename, len);
+}
+
+// Returns 0 if the document has to be parsed by SLR engine
+static int index_read(struct rjson_parser *parser)
+{
+	const LEXCHAR *src = parser->lex.src;
+	int len = parser->lex.size;
+	int nwords = (len + INDEX_BLOCK - 1) / INDEX_BLOCK;
+	uint64_t *bits = malloc((nwords > 0 ? nwords : 1) * sizeof(uint64_t));
+	if (!bits) {
+		fprintf(stderr, "Out of Memory: %d bytes\n", (int)(nwords * sizeof(uint64_t)));
+		exit(-1);
+	}
+	if (index_build(src, len, bits) < 0) {
+		free(bits);
+		return 0;
+	}
+	struct index_walker w = {.parser = parser, .src = src, .len = len, .bits = bits, .nwords = nwords, .word = -1, .cur = 0};
+	struct rjson_value *root = NULL;
+	int ok = index_walk(&w, &root);
+	free(bits);
+	if (!ok) {
+		index_discard(parser);
+		return 0;
+	}
+	parser->json.value = root;
+	return 1;
+}
+
 void rjson_parser_read(struct rjson_parser *parser)
 {
+	if (parser->engine == RJSON_ENGINE_INDEX && index_read(parser))
+		return;
 	parser->json.value = rjson_parser_main(&parser->stream);
 }
+
+enum window_scan {
+	SCAN_VALUE = 0,
+	SCAN_STRING,
+	SCAN_ESCAPE,
+	SCAN_SLASH,
+	SCAN_LINE_COMMENT,
+	SCAN_BLOCK_COMMENT,
+	SCAN_BLOCK_STAR,
+	SCAN_DONE,
+};
+
+// Finds the end of the last complete token in window, so the lexer never sees a partial token
+static void window_scan(struct rjson_parser *parser)
+{
+	const LEXCHAR *src = parser->window;
+	int state = parser->scan;
+	int safe = parser->safe;
+	for (int i = parser->scanned; i < parser->winlen; i++) {
+		int c = src[i];
+		switch (state) {
+		case SCAN_VALUE:
+			if (c == '"') {
+				state = SCAN_STRING;
+			} else if (c == '/') {
+				state = SCAN_SLASH;
+			} else if (c == ' ' || c == '\t' || c == '\n' || c == ',' || c == ':'
+				|| c == '[' || c == ']' || c == '{' || c == '}') {
+				safe = i + 1; // "\r" must be followed by "\n"
+			}
+			break;
+		case SCAN_STRING:
+			if (c == '\\') {
+				state = SCAN_ESCAPE;
+			} else if (c == '"') {
+				state = SCAN_VALUE;
+				safe = i + 1;
+			}
+			break;
+		case SCAN_ESCAPE:
+			state = SCAN_STRING;
+			break;
+		case SCAN_SLASH:
+			if (c == '/') {
+				state = SCAN_LINE_COMMENT;
+			} else if (c == '*') {
+				state = SCAN_BLOCK_COMMENT;
+			} else {
+				state = SCAN_VALUE;
+				i--; // rescan
+			}
+			break;
+		case SCAN_LINE_COMMENT:
+			if (c == '\n') {
+				state = SCAN_VALUE;
+				safe = i + 1;
+			}
+			break;
+		case SCAN_BLOCK_COMMENT:
+			if (c == '*')
+				state = SCAN_BLOCK_STAR;
+			break;
+		case SCAN_BLOCK_STAR:
+			if (c == '/') {
+				state = SCAN_VALUE;
+				safe = i + 1;
+			} else if (c != '*') {
+				state = SCAN_BLOCK_COMMENT;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	parser->scan = state;
+	parser->safe = safe;
+	parser->scanned = parser->winlen;
+}
+
+// Drops the characters which are lexed already, then appends "data"
+static void window_push(struct rjson_parser *parser, const LEXCHAR *data, int len)
+{
+	int drop = parser->lex.pos.max;
+	int keep = parser->winlen - drop;
+	if (drop)
+		memmove(parser->window, (LEXCHAR *)parser->window + drop, keep * sizeof(LEXCHAR));
+	if (keep + len > parser->wincap) {
+		int cap = parser->wincap ? parser->wincap * 2 : 1024;
+		while (cap < keep + len)
+			cap *= 2;
+		void *window = realloc(parser->window, cap * sizeof(LEXCHAR));
+		if (!window) {
+			fprintf(stderr, "Out of Memory: %d characters\n", cap);
+			exit(-1);
+		}
+		parser->window = window;
+		parser->wincap = cap;
+	}
+	if (len)
+		memcpy((LEXCHAR *)parser->window + keep, data, len * sizeof(LEXCHAR));
+	parser->winlen = keep + len;
+	parser->scanned -= drop;
+	parser->safe -= drop;
+}
+
+#ifndef SLRLOOP_SUSPENDS
+#	error "the slrloop isn't patched for RSTREAM_PENDING, see the top of rjson_parser.slr"
+#endif
+
+// Only the input which is not lexed yet is kept, NOTE: the line of error is relative to the current window
+int rjson_parser_feed(struct rjson_parser *parser, const void *data, int len)
+{
+	struct rstream *stream = &parser->stream;
+	if (parser->scan == SCAN_DONE)
+		return 1;
+	window_push(parser, data, len);
+	if (len > 0) {
+		window_scan(parser);
+	} else {
+		parser->safe = parser->winlen;
+	}
+	stream->partial = len > 0;
+
+	crlf_release(&parser->crlfcnt);
+	crlf_lazy(&parser->crlfcnt, parser->window, parser->safe, sizeof(LEXCHAR));
+	parser->lex.src = parser->window;
+	parser->lex.size = parser->safe;
+	parser->lex.pos = (struct rlex_position){0, 0};
+
+	int state = rstream_suspended(stream) ? -1 : MAIN_BEGIN;
+	void *value = rjson_parser_slrloop(stream, state, MAIN_EXP);
+	if (rstream_suspended(stream))
+		return 0;
+	parser->json.value = value;
+	parser->scan = SCAN_DONE;
+	return 1;
+}
+
+RARRAY_DEFINE(sax_stack, char)
+
+#define sax_call(sax, fn, ...)  do { if ((sax)->fn) (sax)->fn((sax)->ud, ##__VA_ARGS__); } while (0)
+
+static void sax_unexpected(struct rjson_parser *parser)
+{
+	struct rlex *lex = &parser->lex;
+	struct lncolumn lcn = crlf_get(&parser->crlfcnt, lex->pos.min);
+	int len = lex->pos.max - lex->pos.min;
+	int outlen = copy_lexchars(lex, lex->pos.min, len, NULL, 0);
+	VLADecl(wchar_t, wcstr, outlen + 1);
+	copy_lexchars(lex, lex->pos.min, len, wcstr, outlen);
+	fprintf(stderr, "%ls:%d: characters %d-%d : UnExpected '%ls'\n",
+		parser->filename, lcn.line, lcn.column, lcn.column + len, wcstr
+	);
+	exit(-1);
+}
+
+// the string is given back to wcspool after the callback
+static void sax_string(struct rjson_parser *parser, const struct rjson_sax *sax, int iskey)
+{
+	rj_wchars wcs = parser->lex.value;
+	parser->lex.value = NULL;
+	if (iskey) {
+		sax_call(sax, on_key, wcs);
+	} else {
+		sax_call(sax, on_string, wcs);
+	}
+	rj_wchars_free(&parser->json, wcs);
+}
+
+static void sax_number(struct rjson_parser *parser, const struct rjson_sax *sax, int neg)
+{
+	struct number_scan num;
+	int64_t integer;
+	double number;
+	const LEXCHAR *source = parser->lex.src;
+	number_scan(source + parser->lex.pos.min, source + parser->lex.pos.max, &num);
+	if (number_value(&num, neg, &integer, &number)) {
+		if (sax->on_integer) {
+			sax->on_integer(sax->ud, integer);
+		} else {
+			sax_call(sax, on_number, (double)integer);
+		}
+	} else {
+		sax_call(sax, on_number, number);
+	}
+}
+
+enum sax_expect {
+	EXPECT_VALUE,
+	EXPECT_KEY,   // or '}' if it's the first key
+	EXPECT_CLOSE, // ',' or the end of container
+};
+
+void rjson_parser_sax(struct rjson_parser *parser, const struct rjson_sax *sax)
+{
+	struct rlex *lex = &parser->lex;
+	struct sax_stack stack;
+	sax_stack_init(&stack);
+	int expect = EXPECT_VALUE;
+	int first = 0; // the first key or value of container
+	int t = rlex_token(lex);
+	if (t == Eof)
+		return;
+	while (1) {
+		char top = sax_stack_len(&stack) ? stack.base[sax_stack_len(&stack) - 1] : 0;
+		switch (expect) {
+		case EXPECT_VALUE:
+			expect = EXPECT_CLOSE;
+			switch (t) {
+			case LBrace:
+				sax_call(sax, begin_object);
+				sax_stack_push(&stack, '{');
+				expect = EXPECT_KEY;
+				first = 1;
+				break;
+			case LBracket:
+				sax_call(sax, begin_array);
+				sax_stack_push(&stack, '[');
+				t = rlex_token(lex);
+				if (t == RBracket) {
+					sax_stack_pop(&stack);
+					sax_call(sax, end_array);
+					break;
+				}
+				expect = EXPECT_VALUE;
+				continue; // "t" is the first value
+			case CString:
+				sax_string(parser, sax, 0);
+				break;
+			case CFloat:
+				sax_number(parser, sax, 0);
+				break;
+			case OpSub:
+				if (rlex_token(lex) != CFloat)
+					sax_unexpected(parser);
+				sax_number(parser, sax, 1);
+				break;
+			case CTrue:
+			case CFalse:
+				sax_call(sax, on_bool, t == CTrue);
+				break;
+			case CNull:
+				sax_call(sax, on_null);
+				break;
+			default:
+				sax_unexpected(parser);
+				break;
+			}
+			break;
+		case EXPECT_KEY:
+			if (t == RBrace && first) {
+				sax_stack_pop(&stack);
+				sax_call(sax, end_object);
+				expect = EXPECT_CLOSE;
+				break;
+			}
+			if (t != CString)
+				sax_unexpected(parser);
+			sax_string(parser, sax, 1);
+			if (rlex_token(lex) != DblDot)
+				sax_unexpected(parser);
+			expect = EXPECT_VALUE;
+			break;
+		case EXPECT_CLOSE:
+			if (t == Comma) {
+				expect = top == '{' ? EXPECT_KEY : EXPECT_VALUE;
+				first = 0;
+			} else if (t == RBrace && top == '{') {
+				sax_stack_pop(&stack);
+				sax_call(sax, end_object);
+			} else if (t == RBracket && top == '[') {
+				sax_stack_pop(&stack);
+				sax_call(sax, end_array);
+			} else {
+				sax_unexpected(parser);
+			}
+			break;
+		default:
+			break;
+		}
+		if (expect == EXPECT_CLOSE && sax_stack_len(&stack) == 0)
+			break; // the end of document
+		t = rlex_token(lex);
+	}
+	sax_stack_release(&stack);
+}
+
+#define READ_BLOCK            (64 * 1024)
+
+static void parse_mapped(struct rjson_parser *parser, wchar_t *filename, const void *map, size_t size)
+{
+	rjson_parser_init(parser, filename, (LEXCHAR *)map, (int)(size / sizeof(LEXCHAR)));
+	rjson_parser_read(parser);
+	// the DOM doesn't refer to the mapping
+	crlf_release(&parser->crlfcnt);
+	parser->lex.src = NULL;
+	parser->lex.size = 0;
+	parser->lex.pos = (struct rlex_position){0, 0};
+}
+
+static void parse_stream(struct rjson_parser *parser, wchar_t *filename, FILE *file)
+{
+	rjson_parser_init(parser, filename, NULL, 0);
+	LEXCHAR *block = malloc(READ_BLOCK);
+	if (!block) {
+		fprintf(stderr, "Out of Memory: %d bytes\n", READ_BLOCK);
+		exit(-1);
+	}
+	int done = 0;
+	int n;
+	while (!done && (n = (int)fread(block, sizeof(LEXCHAR), READ_BLOCK / sizeof(LEXCHAR), file)) > 0) {
+		done = rjson_parser_feed(parser, block, n);
+	}
+	if (!done)
+		rjson_parser_feed(parser, NULL, 0);
+	free(block);
+}
+
+int rjson_parse_file(struct rjson_parser *parser, const char *path)
+{
+	int len = path ? (int)strlen(path) : 0;
+	VLADecl(wchar_t, wcspath, UTF8TOWCS_BOUND(len) + 1);
+	wcspath[utf8towcs(wcspath, (const unsigned char *)path, len)] = 0;
+	wchar_t *filename = path ? wcspath : L"<stdin>";
+	if (path == NULL) {
+		parse_stream(parser, filename, stdin);
+		return 1;
+	}
+	const void *map = NULL;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return 0;
+	LARGE_INTEGER li;
+	if (GetFileType(file) == FILE_TYPE_DISK && GetFileSizeEx(file, &li) && li.QuadPart > 0 && li.QuadPart <= INT_MAX) {
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping) {
+			map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			size = (size_t)li.QuadPart;
+			CloseHandle(mapping); // the view keeps the mapping
+		}
+	}
+	CloseHandle(file);
+	if (map) {
+		parse_mapped(parser, filename, map, size);
+		UnmapViewOfFile(map);
+		return 1;
+	}
+	FILE *stream = fopen(path, "rb");
+	if (!stream)
+		return 0;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && st.st_size <= INT_MAX) {
+		size = (size_t)st.st_size;
+		map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			map = NULL;
+		} else {
+			madvise((void *)map, size, MADV_SEQUENTIAL);
+		}
+	}
+	if (map) {
+		close(fd);
+		parse_mapped(parser, filename, map, size);
+		munmap((void *)map, size);
+		return 1;
+	}
+	FILE *stream = fdopen(fd, "rb");
+	if (!stream) {
+		close(fd);
+		return 0;
+	}
+#endif
+	parse_stream(parser, filename, stream);
+	fclose(stream);
+	return 1;
+}
@@ -0,0 +1,326 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0
+ */
+#include "rope.h"
+
+struct span {
+	int bytes;
+	int lines;
+};
+
+struct leaf {
+	struct rb_node rb;
+	struct span sub; // subtree
+	int len;
+	int lines;
+	char data[0];
+};
+
+#define leaf_entry(node)    rb_entry(node, struct leaf, rb)
+#define sub_bytes(node)     ((node) ? leaf_entry(node)->sub.bytes : 0)
+#define sub_lines(node)     ((node) ? leaf_entry(node)->sub.lines : 0)
+
+static int count_lf(const char *ptr, int len)
+{
+	int n = 0;
+	const char *max = ptr + len;
+	while ((ptr = memchr(ptr, '\n', max - ptr))) {
+		ptr++;
+		n++;
+	}
+	return n;
+}
+
+static inline bool leaf_compute(struct leaf *leaf, bool exit)
+{
+	struct rb_node *node = &leaf->rb;
+	struct span sub = {
+		.bytes = leaf->len + sub_bytes(node->rb_left) + sub_bytes(node->rb_right),
+		.lines = leaf->lines + sub_lines(node->rb_left) + sub_lines(node->rb_right),
+	};
+	if (exit && leaf->sub.bytes == sub.bytes && leaf->sub.lines == sub.lines)
+		return true;
+	leaf->sub = sub;
+	return false;
+}
+
+RB_DECLARE_CALLBACKS(static, leaf_augment, struct leaf, rb, sub, leaf_compute)
+
+void rope_init(struct rope *rope)
+{
+	rope->root = RB_ROOT;
+}
+
+void rope_release(struct rope *rope)
+{
+	struct rb_node *next;
+	struct rb_node *node = rb_first_postorder(&rope->root);
+	while (node) {
+		next = rb_next_postorder(node);
+		rb_free(leaf_entry(node));
+		node = next;
+	}
+	rope->root = RB_ROOT;
+}
+
+int rope_length(struct rope *rope)
+{
+	return sub_bytes(rope->root.rb_node);
+}
+
+int rope_lines(struct rope *rope)
+{
+	return sub_lines(rope->root.rb_node);
+}
+
+/*
+ * Finds the leaf which contains "pos", the offset in leaf will be saved to "*pos",
+ * and the number of '\n' before the leaf will be saved to "*lines"
+ */
+static struct leaf *leaf_find(struct rope *rope, int *pos, int *lines)
+{
+	struct rb_node *node = rope->root.rb_node;
+	int off = *pos;
+	int lf = 0;
+	while (node) {
+		struct leaf *leaf = leaf_entry(node);
+		int left = sub_bytes(node->rb_left);
+		if (off < left) {
+			node = node->rb_left;
+			continue;
+		}
+		off -= left;
+		lf += sub_lines(node->rb_left);
+		if (off <= leaf->len || !node->rb_right) {
+			*pos = off;
+			*lines = lf;
+			return leaf;
+		}
+		off -= leaf->len;
+		lf += leaf->lines;
+		node = node->rb_right;
+	}
+	return NULL;
+}
+
+static struct leaf *leaf_new(const char *src, int len)
+{
+	struct leaf *leaf = rb_malloc(sizeof(struct leaf) + ROPE_LEAF_SIZE);
+	if (!leaf)
+		return NULL;
+	memcpy(leaf->data, src, len);
+	leaf->len = len;
+	leaf->lines = count_lf(src, len);
+	leaf->sub = (struct span){len, leaf->lines};
+	return leaf;
+}
+
+// Links "leaf" as the in-order successor of "prev", or as the first leaf if "prev" is NULL
+static void leaf_link_after(struct rope *rope, struct leaf *prev, struct leaf *leaf)
+{
+	struct rb_node **link = &rope->root.rb_node;
+	struct rb_node *parent = NULL;
+	if (prev) {
+		parent = &prev->rb;
+		link = &parent->rb_right;
+	}
+	while (*link) {
+		parent = *link;
+		link = &parent->rb_left;
+	}
+	rb_link_node(&leaf->rb, parent, link);
+	leaf_augment_propagate(parent, NULL);
+	rb_insert_augmented(&leaf->rb, &rope->root, &leaf_augment);
+}
+
+// Splits "src" into leaves after "*prev" which is updated to the last one, returns the number of bytes inserted
+static int leaf_insert_after(struct rope *rope, struct leaf **prev, const char *src, int len)
+{
+	int done = 0;
+	while (done < len) {
+		int n = len - done < ROPE_LEAF_SIZE ? len - done : ROPE_LEAF_SIZE;
+		struct leaf *leaf = leaf_new(src + done, n);
+		if (!leaf)
+			break;
+		leaf_link_after(rope, *prev, leaf);
+		*prev = leaf;
+		done += n;
+	}
+	return done;
+}
+
+static void leaf_update(struct leaf *leaf)
+{
+	leaf->lines = count_lf(leaf->data, leaf->len);
+	leaf_augment_propagate(&leaf->rb, NULL);
+}
+
+// Moves the successor of "leaf" into it if one of them is under half full and both fit in one leaf
+static bool leaf_merge_next(struct rope *rope, struct leaf *leaf)
+{
+	struct rb_node *node = rb_next(&leaf->rb);
+	if (!node)
+		return false;
+	struct leaf *next = leaf_entry(node);
+	if (leaf->len + next->len > ROPE_LEAF_SIZE)
+		return false;
+	if (leaf->len >= ROPE_LEAF_SIZE / 2 && next->len >= ROPE_LEAF_SIZE / 2)
+		return false;
+	rb_erase_augmented(&next->rb, &rope->root, &leaf_augment);
+	memcpy(leaf->data + leaf->len, next->data, next->len);
+	leaf->len += next->len;
+	leaf->lines += next->lines;
+	leaf_augment_propagate(&leaf->rb, NULL);
+	rb_free(next);
+	return true;
+}
+
+// Merges the undersized leaves around "pos", so that edits don't leave a trail of tiny leaves
+static void rope_compact(struct rope *rope, int pos)
+{
+	int lines;
+	struct leaf *leaf = leaf_find(rope, &pos, &lines);
+	if (!leaf)
+		return;
+	struct rb_node *prev = rb_prev(&leaf->rb);
+	if (prev && leaf_merge_next(rope, leaf_entry(prev)))
+		leaf = leaf_entry(prev);
+	leaf_merge_next(rope, leaf);
+}
+
+int rope_insert(struct rope *rope, int pos, const char *src, int len)
+{
+	if (!src || len <= 0)
+		return 0;
+	int lines, done;
+	int length = rope_length(rope);
+	if (pos < 0)
+		pos = 0;
+	if (pos > length)
+		pos = length;
+	int at = pos;
+	struct leaf *leaf = leaf_find(rope, &pos, &lines);
+	if (leaf && leaf->len + len <= ROPE_LEAF_SIZE) {
+		char *ptr = leaf->data + pos;
+		memmove(ptr + len, ptr, leaf->len - pos);
+		memcpy(ptr, src, len);
+		leaf->len += len;
+		leaf->lines += count_lf(src, len);
+		leaf_augment_propagate(&leaf->rb, NULL);
+		return 0;
+	}
+	struct leaf *prev = NULL;
+	if (leaf && pos == 0) {
+		struct rb_node *node = rb_prev(&leaf->rb);
+		prev = node ? leaf_entry(node) : NULL;
+	} else if (leaf) {
+		// split leaf at "pos", the tail is copied before the leaf is truncated so nothing is lost if out of memory
+		int tailen = leaf->len - pos;
+		prev = leaf;
+		done = leaf_insert_after(rope, &prev, leaf->data + pos, tailen);
+		if (done < tailen) {
+			rope_delete(rope, at + tailen, done);
+			return -1;
+		}
+		leaf->len = pos;
+		leaf_update(leaf);
+		prev = leaf;
+	}
+	done = leaf_insert_after(rope, &prev, src, len);
+	if (done < len) {
+		rope_delete(rope, at, done);
+		return -1;
+	}
+	rope_compact(rope, at);
+	rope_compact(rope, at + len);
+	return 0;
+}
+
+void rope_delete(struct rope *rope, int pos, int len)
+{
+	int lines;
+	if (pos < 0) {
+		len += pos;
+		pos = 0;
+	}
+	int at = pos;
+	struct leaf *leaf = len > 0 ? leaf_find(rope, &pos, &lines) : NULL;
+	while (leaf && len > 0) {
+		struct rb_node *next = rb_next(&leaf->rb);
+		int n = leaf->len - pos;
+		if (n > len)
+			n = len;
+		if (n == leaf->len) {
+			rb_erase_augmented(&leaf->rb, &rope->root, &leaf_augment);
+			rb_free(leaf);
+		} else if (n > 0) {
+			char *ptr = leaf->data + pos;
+			memmove(ptr, ptr + n, leaf->len - pos - n);
+			leaf->len -= n;
+			leaf_update(leaf);
+		}
+		len -= n;
+		pos = 0;
+		leaf = next ? leaf_entry(next) : NULL;
+	}
+	rope_compact(rope, at);
+}
+
+int rope_slice(struct rope *rope, int pos, int len, char *out)
+{
+	int lines;
+	int i = 0;
+	if (pos < 0 || len <= 0 || pos >= rope_length(rope))
+		return 0;
+	struct leaf *leaf = leaf_find(rope, &pos, &lines);
+	while (leaf && i < len) {
+		int n = leaf->len - pos;
+		if (n > len - i)
+			n = len - i;
+		memcpy(out + i, leaf->data + pos, n);
+		i += n;
+		pos = 0;
+		struct rb_node *next = rb_next(&leaf->rb);
+		leaf = next ? leaf_entry(next) : NULL;
+	}
+	return i;
+}
+
+// Returns the offset after the nth '\n', n start at 1
+static int rope_line_start(struct rope *rope, int n)
+{
+	struct rb_node *node = rope->root.rb_node;
+	int base = 0;
+	while (node) {
+		struct leaf *leaf = leaf_entry(node);
+		int left = sub_lines(node->rb_left);
+		if (n <= left) {
+			node = node->rb_left;
+			continue;
+		}
+		n -= left;
+		base += sub_bytes(node->rb_left);
+		if (n <= leaf->lines) {
+			const char *ptr = leaf->data - 1;
+			while (n--)
+				ptr = memchr(ptr + 1, '\n', leaf->len - (ptr + 1 - leaf->data));
+			return base + (int)(ptr + 1 - leaf->data);
+		}
+		n -= leaf->lines;
+		base += leaf->len;
+		node = node->rb_right;
+	}
+	return base;
+}
+
+struct lncolumn rope_get(struct rope *rope, int pos)
+{
+	int lines = 0;
+	int off = pos;
+	struct leaf *leaf = pos > 0 ? leaf_find(rope, &off, &lines) : NULL;
+	if (leaf)
+		lines += count_lf(leaf->data, off < leaf->len ? off : leaf->len);
+	if (lines == 0)
+		return (struct lncolumn){.line = 1, .column = pos + 1};
+	return (struct lncolumn){.line = lines + 1, .column = pos - rope_line_start(rope, lines) + 1};
+}
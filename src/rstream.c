@@ -2,18 +2,123 @@
  * SPDX-License-Identifier: GPL-2.0
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "rstream.h"
 
 #define stream_offset(rs, i)   ((rs)->head + (i))
 #define stream_length(rs)      ((int)((rs)->tail - (rs)->head))
 #define lexeme_token(rs)       ((rs)->lex->token((rs)->lex))
 
+/*
+ * [cached, head) is the SLR stack and [head, tail) is the lookahead, they must be contiguous
+ * because the generated slrloop shifts/unshifts by "head++/head -= n".
+ * junk, move and reduce only move the lookahead(at most 1 token during reductions)
+ */
+static inline void lookahead_move(struct rstream_tok *dst, struct rstream_tok *src, int len)
+{
+	if (len == 1) {
+		*dst = *src;
+	} else if (len > 1) {
+		memmove(dst, src, len * sizeof(struct rstream_tok));
+	}
+}
+
+// Make sure there is space for "n" more tokens after tail, exit if stream->limit is exceeded
+static void stream_reserve(struct rstream *stream, int n)
+{
+	int used = (int)(stream->tail - stream->base);
+	if (used + n <= stream->cap)
+		return;
+	int cap = stream->cap * 2;
+	while (cap < used + n)
+		cap *= 2;
+	if (cap > stream->limit)
+		cap = stream->limit;
+	if (used + n > cap) {
+		fprintf(stderr, "Nesting Too Deep: %d tokens at %d\n", stream->limit, stream->tail[-1].pos.max);
+		exit(-1);
+	}
+	struct rstream_tok *base;
+	if (stream->base == stream->cached) {
+		base = rs_realloc(NULL, cap * sizeof(struct rstream_tok));
+		if (base)
+			memcpy(base, stream->cached, used * sizeof(struct rstream_tok));
+	} else {
+		base = rs_realloc(stream->base, cap * sizeof(struct rstream_tok));
+	}
+	if (!base) {
+		fprintf(stderr, "Out of Memory: %d tokens\n", cap);
+		exit(-1);
+	}
+	stream->head = base + (stream->head - stream->base);
+	stream->tail = base + used;
+	stream->base = base;
+	stream->cap = cap;
+}
+
+static void tape_fill(struct rstream *stream)
+{
+	struct rlex *const lex = stream->lex;
+	struct rstream_lexeme *const tape = stream->tape;
+	const int max = stream->tape_cap;
+	int n = 0;
+	int nvalue = 0;
+	while (n < max) {
+		int term = lex->token(lex);
+		int len = lex->pos.max - lex->pos.min;
+		if (len >= (1 << 26)) {
+			fprintf(stderr, "Token Too Long: %d-%d\n", lex->pos.min, lex->pos.max);
+			exit(-1);
+		}
+		tape[n].offset = lex->pos.min;
+		tape[n].term = term;
+		tape[n].valued = lex->value != NULL;
+		tape[n].len = len > 0 ? len : 0;
+		if (lex->value) {
+			stream->tape_values[nvalue++] = lex->value;
+			lex->value = NULL;
+		}
+		n++;
+		if (term == 0) // Eof
+			break;
+	}
+	stream->tape_pos = 0;
+	stream->tape_len = n;
+	stream->tape_vpos = 0;
+}
+
+// lexeme => stream->tail, but doesn't update tail
+static inline void stream_lex(struct rstream *stream)
+{
+	struct rstream_tok *tok = stream->tail;
+	if (!stream->tape) {
+		tok->term = lexeme_token(stream);
+		tok->pos = stream->lex->pos;
+		tok->value = stream->lex->value;
+		stream->lex->value = NULL;
+		if (tok->term == 0 && stream->partial)
+			tok->term = RSTREAM_PENDING;
+		return;
+	}
+	if (stream->tape_pos == stream->tape_len)
+		tape_fill(stream);
+	const struct rstream_lexeme *lexeme = stream->tape + stream->tape_pos;
+	if (lexeme->term || stream->partial) // Eof stays on the tape unless more input will come
+		stream->tape_pos++;
+	tok->term = lexeme->term || !stream->partial ? lexeme->term : RSTREAM_PENDING;
+	tok->pos = (struct rlex_position){lexeme->offset, lexeme->offset + lexeme->len};
+	tok->value = lexeme->valued ? stream->tape_values[stream->tape_vpos++] : NULL;
+}
+
 // peek(0) means peek current token
 struct rstream_tok *rstream_peek(struct rstream *stream, int i)
 {
+	if (stream_length(stream) <= i)
+		stream_reserve(stream, i + 1 - stream_length(stream));
 	while (stream_length(stream) <= i) {
-		stream->tail->term = lexeme_token(stream);
-		stream->tail->pos = stream->lex->pos;
+		stream_lex(stream);
 		stream->tail++;
 	}
 	return stream_offset(stream, i);
@@ -26,13 +131,7 @@ void rstream_junk(struct rstream *stream, int n)
 	int len = stream_length(stream);
 	if (len > n) {
 		stream->tail -= n;
-		len -= n;
-		int i = 0;
-		struct rstream_tok *const cur = stream_offset(stream, 0);
-		while (i < len) {
-			cur[i] = cur[i + n]; // struct copy from LEFT to RIGHT
-			++i;
-		}
+		lookahead_move(stream->head, stream->head + n, len - n);
 	} else {
 		stream->tail = stream->head;
 	/*
@@ -47,16 +146,66 @@ void rstream_junk(struct rstream *stream, int n)
 void rstream_init(struct rstream *stream, struct rlex *lex)
 {
 	stream->lex = lex;
+	stream->base = stream->cached;
+	stream->cap = (int)(sizeof(stream->cached) / sizeof(stream->cached[0]));
+	stream->limit = RSTREAM_LIMIT;
+	stream->partial = 0;
+	stream->head = stream->cached;
+	stream->tail = stream->cached;
+	stream->tape = NULL;
+	stream->tape_values = NULL;
+	stream->tape_pos = 0;
+	stream->tape_len = 0;
+	stream->tape_cap = 0;
+	stream->tape_vpos = 0;
+}
+
+void rstream_tape(struct rstream *stream, int block)
+{
+	if (stream->tape_pos < stream->tape_len)
+		return; // the tape is in use
+	rs_free(stream->tape);
+	rs_free(stream->tape_values);
+	stream->tape = NULL;
+	stream->tape_values = NULL;
+	stream->tape_pos = 0;
+	stream->tape_len = 0;
+	stream->tape_cap = 0;
+	if (block <= 0)
+		return;
+	stream->tape = rs_realloc(NULL, block * sizeof(struct rstream_lexeme));
+	stream->tape_values = rs_realloc(NULL, block * sizeof(void *));
+	if (stream->tape && stream->tape_values) {
+		stream->tape_cap = block;
+	} else {
+		rs_free(stream->tape);
+		rs_free(stream->tape_values);
+		stream->tape = NULL;
+		stream->tape_values = NULL;
+	}
+}
+
+void rstream_release(struct rstream *stream)
+{
+	if (stream->base != stream->cached)
+		rs_free(stream->base);
+	stream->base = stream->cached;
 	stream->head = stream->cached;
 	stream->tail = stream->cached;
+	rs_free(stream->tape);
+	rs_free(stream->tape_values);
+	stream->tape = NULL;
+	stream->tape_values = NULL;
+	stream->tape_pos = 0;
+	stream->tape_len = 0;
 }
 
 // For internal use only
 struct rstream_tok *rstream_next(struct rstream *stream)
 {
 	if (stream->head == stream->tail) { // stream_length(stream) == 0
-		stream->tail->term = lexeme_token(stream);
-		stream->tail->pos = stream->lex->pos;
+		stream_reserve(stream, 1);
+		stream_lex(stream);
 		stream->tail++;
 	}
 	return stream->head++;
@@ -67,11 +216,8 @@ static void move(struct rstream *stream, int n)
 {
 	if (n <= 0)
 		return;
-	struct rstream_tok *curr = stream_offset(stream, 0);
-	int len = stream_length(stream);
-	while (len--) {
-		curr[len + n] = curr[len]; // struct copy from RIGHT to LEFT
-	}
+	stream_reserve(stream, n);
+	lookahead_move(stream->head + n, stream->head, stream_length(stream));
 	stream->head += n;
 	stream->tail += n;
 }
@@ -79,17 +225,17 @@ static void move(struct rstream *stream, int n)
 // For internal use only
 struct rstream_tok *rstream_reserve(struct rstream *stream)
 {
-	struct rstream_tok *curr = stream_offset(stream, 0);
 	move(stream, 1);
+	struct rstream_tok *curr = stream_offset(stream, -1); // "move" could grow the stream
 	curr->pos = (struct rlex_position){0, 0};
 	return curr;
 }
 
 static struct rstream_tok *rstream_reduce_epsilon(struct rstream *stream)
 {
-	struct rstream_tok *curr = stream_offset(stream, 0);
-	int pmax = (curr - 1)->pos.max;
+	int pmax = stream_offset(stream, -1)->pos.max;
 	move(stream, 1);
+	struct rstream_tok *curr = stream_offset(stream, -1);
 	curr->pos = (struct rlex_position){pmax, pmax};
 	return curr;
 }
@@ -105,13 +251,7 @@ struct rstream_tok *rstream_reduce(struct rstream *stream, int width)
 	stream->tail -= width;
 	struct rstream_tok *const tok = stream_offset(stream, -1); // related to the reserved block
 	tok->pos.max = pmax;
-	if (width) {
-		// fast junk(width)
-		int len = stream_length(stream);
-		int i = 0;
-		while (i++ < len) {         // i start at "1" because tok is -1
-			tok[i] = tok[i + width];
-		}
-	}
+	if (width)
+		lookahead_move(stream->head, stream->head + width, stream_length(stream)); // fast junk(width)
 	return tok;
 }
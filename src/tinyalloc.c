@@ -214,13 +214,14 @@ void bumpalloc_init(struct bumpalloc_root *bump, int chksize)
 	};
 }
 
+static inline int bump_size(int size)
+{
+	return size < BLK_BASE ? BLK_BASE : ALIGN_POW2(size, BLK_BASE);
+}
+
 void *bumpalloc(struct bumpalloc_root *bump, int size)
 {
-	if (size < BLK_BASE) {
-		size = BLK_BASE;
-	} else {
-		size = ALIGN_POW2(size, BLK_BASE);
-	}
+	size = bump_size(size);
 	struct chunk *chk = chunk_pickup(the_base(bump), size);
 	if (!chk)
 		return NULL;
@@ -229,6 +230,16 @@ void *bumpalloc(struct bumpalloc_root *bump, int size)
 	return ptr;
 }
 
+void bumpshrink(struct bumpalloc_root *bump, void *ptr, int size, int newsize)
+{
+	struct chunk *chk = chk_head(the_base(bump));
+	size = bump_size(size);
+	newsize = newsize > 0 ? bump_size(newsize) : 0;
+	if (!chk || newsize >= size || chk_dataptr(chk) - size != (char *)ptr)
+		return;
+	chk->pos -= size - newsize;
+}
+
 void bumpreset(struct bumpalloc_root *bump)
 {
 	chunks_reset(the_base(bump));
@@ -1,8 +1,25 @@
 #include "ucs2.h"
+
+#define UTF8_ACCEPT UTF8_DECODER_ACCEPT
+#define UTF8_REJECT UTF8_DECODER_REJECT
+
+#if !defined(UCS2_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#	define UCS2_SSE2 1
+#	include <emmintrin.h>
+#endif
+#if !defined(UCS2_NO_SIMD) && (defined(_M_X64) || (defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))))
+#	define UCS2_AVX2 1
+#	include <immintrin.h>
+#	ifdef _MSC_VER
+#		include <intrin.h>
+#		define TARGET_AVX2
+#	else
+#		define TARGET_AVX2 __attribute__((target("avx2")))
+#	endif
+#endif
+
 // Copyright (c) 2008-2010 Bjoern Hoehrmann <bjoern@hoehrmann.de>
 // See http://bjoern.hoehrmann.de/utf-8/decoder/dfa/ for details.
-#define UTF8_ACCEPT 0
-#define UTF8_REJECT 12
 
 static const uint8_t utf8d[] = {
 	// The first part of the table maps bytes to character classes that
@@ -37,15 +54,330 @@ static uint32_t inline decode(uint32_t *state, uint32_t *codep, uint32_t byte)
 	return *state;
 }
 
+/*
+ * ASCII kernels: widen/narrow the leading ASCII run of "src", "out" could be NULL for counting.
+ * returns the number of elements processed, which stops at the first non-ASCII element
+ */
+static int widen_scalar(unsigned short *out, const unsigned char *src, int len)
+{
+	int i = 0;
+	uint64_t w;
+	while (len - i >= 8) {
+		memcpy(&w, src + i, 8);
+		if (w & 0x8080808080808080ULL)
+			break;
+		if (out) {
+			for (int k = 0; k < 8; k++)
+				out[i + k] = src[i + k];
+		}
+		i += 8;
+	}
+	while (i < len && src[i] < 0x80) {
+		if (out)
+			out[i] = src[i];
+		i++;
+	}
+	return i;
+}
+
+static int narrow_scalar(unsigned char *out, const unsigned short *src, int len)
+{
+	int i = 0;
+	uint64_t w;
+	while (len - i >= 4) {
+		memcpy(&w, src + i, 8);
+		if (w & 0xFF80FF80FF80FF80ULL)
+			break;
+		if (out) {
+			for (int k = 0; k < 4; k++)
+				out[i + k] = (unsigned char)src[i + k];
+		}
+		i += 4;
+	}
+	while (i < len && src[i] < 0x80) {
+		if (out)
+			out[i] = (unsigned char)src[i];
+		i++;
+	}
+	return i;
+}
+
+#ifdef UCS2_SSE2
+static int widen_sse2(unsigned short *out, const unsigned char *src, int len)
+{
+	int i = 0;
+	const __m128i zero = _mm_setzero_si128();
+	while (len - i >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		if (_mm_movemask_epi8(v))
+			break;
+		if (out) {
+			_mm_storeu_si128((__m128i *)(out + i    ), _mm_unpacklo_epi8(v, zero));
+			_mm_storeu_si128((__m128i *)(out + i + 8), _mm_unpackhi_epi8(v, zero));
+		}
+		i += 16;
+	}
+	return i + widen_scalar(out ? out + i : NULL, src + i, len - i);
+}
+
+static int narrow_sse2(unsigned char *out, const unsigned short *src, int len)
+{
+	int i = 0;
+	const __m128i mask = _mm_set1_epi16((short)0xFF80);
+	const __m128i zero = _mm_setzero_si128();
+	while (len - i >= 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(src + i    ));
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + i + 8));
+		__m128i t = _mm_and_si128(_mm_or_si128(a, b), mask);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(t, zero)) != 0xFFFF)
+			break;
+		if (out)
+			_mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(a, b));
+		i += 16;
+	}
+	return i + narrow_scalar(out ? out + i : NULL, src + i, len - i);
+}
+#endif
+
+#ifdef UCS2_AVX2
+TARGET_AVX2
+static int widen_avx2(unsigned short *out, const unsigned char *src, int len)
+{
+	int i = 0;
+	while (len - i >= 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+		if (_mm256_movemask_epi8(v))
+			break;
+		if (out) {
+			_mm256_storeu_si256((__m256i *)(out + i     ), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+			_mm256_storeu_si256((__m256i *)(out + i + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+		}
+		i += 32;
+	}
+	return i + widen_scalar(out ? out + i : NULL, src + i, len - i);
+}
+
+TARGET_AVX2
+static int narrow_avx2(unsigned char *out, const unsigned short *src, int len)
+{
+	int i = 0;
+	const __m256i mask = _mm256_set1_epi16((short)0xFF80);
+	while (len - i >= 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(src + i     ));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(src + i + 16));
+		if (!_mm256_testz_si256(_mm256_or_si256(a, b), mask))
+			break;
+		if (out) {
+			__m256i v = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+			_mm256_storeu_si256((__m256i *)(out + i), v);
+		}
+		i += 32;
+	}
+	return i + narrow_scalar(out ? out + i : NULL, src + i, len - i);
+}
+
+/*
+ * UTF-8 validation by lookup tables, see:
+ * John Keiser, Daniel Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte"
+ *
+ * returns the offset of the first 32-bytes block that has an error, or where the tail starts.
+ * all bytes before the returned offset are valid, but the last sequence might be incomplete.
+ * The lookups need pshufb(SSSE3), so there is no SSE2 version: without AVX2 the scalar DFA
+ * does the work and skips the ASCII runs 16 bytes at a time by widen_sse2
+ */
+#define TOO_SHORT      (1 << 0) // 11______ 0_______ / 11______ 11______
+#define TOO_LONG       (1 << 1) // 0_______ 10______
+#define OVERLONG_3     (1 << 2) // 11100000 100_____
+#define TOO_LARGE      (1 << 3) // 11110100 1001____ ...
+#define SURROGATE      (1 << 4) // 11101101 101_____
+#define OVERLONG_2     (1 << 5) // 1100000_ 10______
+#define TOO_LARGE_1000 (1 << 6) // 11110101 1000____ ...
+#define OVERLONG_4     (1 << 6) // 11110000 1000____
+#define TWO_CONTS      (1 << 7) // 10______ 10______
+#define CARRY          (TOO_SHORT | TOO_LONG | TWO_CONTS)
+#define LARGE          (TOO_LARGE | TOO_LARGE_1000)
+#define B(x)           ((char)(x))
+
+TARGET_AVX2
+static int validate_avx2(const unsigned char *src, int len)
+{
+	const __m256i byte_1_high = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+		// 0_______ ________ <ASCII in byte 1>
+		B(TOO_LONG), B(TOO_LONG), B(TOO_LONG), B(TOO_LONG),
+		B(TOO_LONG), B(TOO_LONG), B(TOO_LONG), B(TOO_LONG),
+		// 10______ ________ <continuation in byte 1>
+		B(TWO_CONTS), B(TWO_CONTS), B(TWO_CONTS), B(TWO_CONTS),
+		// 1100____, 1101____, 1110____, 1111____ <lead in byte 1>
+		B(TOO_SHORT | OVERLONG_2),
+		B(TOO_SHORT),
+		B(TOO_SHORT | OVERLONG_3 | SURROGATE),
+		B(TOO_SHORT | LARGE | OVERLONG_4)
+	));
+	const __m256i byte_1_low = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+		B(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4), // ____0000
+		B(CARRY | OVERLONG_2),                           // ____0001
+		B(CARRY), B(CARRY),                              // ____001_
+		B(CARRY | TOO_LARGE),                            // ____0100
+		B(CARRY | LARGE), B(CARRY | LARGE), B(CARRY | LARGE),
+		B(CARRY | LARGE), B(CARRY | LARGE), B(CARRY | LARGE), B(CARRY | LARGE),
+		B(CARRY | LARGE),
+		B(CARRY | LARGE | SURROGATE),                    // ____1101
+		B(CARRY | LARGE), B(CARRY | LARGE)
+	));
+	const __m256i byte_2_high = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+		// ________ 0_______ <ASCII in byte 2>
+		B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT),
+		B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT),
+		// ________ 1000____, 1001____, 101_____
+		B(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4),
+		B(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE),
+		B(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE  | TOO_LARGE),
+		B(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE  | TOO_LARGE),
+		// ________ 11______
+		B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT)
+	));
+	// the last 3 bytes of a block must not start a multi-byte sequence
+	const __m256i max_value = _mm256_setr_epi8(
+		B(255), B(255), B(255), B(255), B(255), B(255), B(255), B(255),
+		B(255), B(255), B(255), B(255), B(255), B(255), B(255), B(255),
+		B(255), B(255), B(255), B(255), B(255), B(255), B(255), B(255),
+		B(255), B(255), B(255), B(255), B(255), B(0xF0 - 1), B(0xE0 - 1), B(0xC0 - 1)
+	);
+	const __m256i nibble = _mm256_set1_epi8(0x0F);
+	const __m256i high = _mm256_set1_epi8(B(0x80));
+	const __m256i third = _mm256_set1_epi8(B(0xE0 - 0x80));
+	const __m256i fourth = _mm256_set1_epi8(B(0xF0 - 0x80));
+	__m256i prev = _mm256_setzero_si256();
+	__m256i incomplete = _mm256_setzero_si256();
+	__m256i error;
+	int i = 0;
+	while (len - i >= 32) {
+		__m256i input = _mm256_loadu_si256((const __m256i *)(src + i));
+		if (!_mm256_movemask_epi8(input)) {
+			error = incomplete;
+		} else {
+			__m256i shifted = _mm256_permute2x128_si256(prev, input, 0x21);
+			__m256i prev1 = _mm256_alignr_epi8(input, shifted, 15);
+			__m256i prev2 = _mm256_alignr_epi8(input, shifted, 14);
+			__m256i prev3 = _mm256_alignr_epi8(input, shifted, 13);
+			__m256i sc = _mm256_and_si256(
+				_mm256_and_si256(
+					_mm256_shuffle_epi8(byte_1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+					_mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, nibble))
+				),
+				_mm256_shuffle_epi8(byte_2_high, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble))
+			);
+			__m256i must23 = _mm256_or_si256(_mm256_subs_epu8(prev2, third), _mm256_subs_epu8(prev3, fourth));
+			error = _mm256_xor_si256(_mm256_and_si256(must23, high), sc);
+			incomplete = _mm256_subs_epu8(input, max_value);
+		}
+		if (!_mm256_testz_si256(error, error))
+			break;
+		prev = input;
+		i += 32;
+	}
+	return i;
+}
+
+#undef TOO_SHORT
+#undef TOO_LONG
+#undef OVERLONG_3
+#undef TOO_LARGE
+#undef SURROGATE
+#undef OVERLONG_2
+#undef TOO_LARGE_1000
+#undef OVERLONG_4
+#undef TWO_CONTS
+#undef CARRY
+#undef LARGE
+#undef B
+
+static int cpu_has_avx2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return 0;
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) // OSXSAVE, AVX
+		return 0;
+	if ((_xgetbv(0) & 6) != 6)
+		return 0;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+static int widen_init(unsigned short *out, const unsigned char *src, int len);
+static int narrow_init(unsigned char *out, const unsigned short *src, int len);
+static int validate_init(const unsigned char *src, int len);
+
+// runtime dispatch, the first call selects the best kernel. "utf8_scan" is NULL if there is no SIMD validator
+static int (*ascii_widen)(unsigned short *, const unsigned char *, int) = widen_init;
+static int (*ascii_narrow)(unsigned char *, const unsigned short *, int) = narrow_init;
+static int (*utf8_scan)(const unsigned char *, int) = validate_init;
+
+static void ascii_dispatch()
+{
+	int (*widen)(unsigned short *, const unsigned char *, int) = widen_scalar;
+	int (*narrow)(unsigned char *, const unsigned short *, int) = narrow_scalar;
+	int (*scan)(const unsigned char *, int) = NULL;
+#ifdef UCS2_SSE2
+	widen = widen_sse2;
+	narrow = narrow_sse2;
+#endif
+#ifdef UCS2_AVX2
+	if (cpu_has_avx2()) {
+		widen = widen_avx2;
+		narrow = narrow_avx2;
+		scan = validate_avx2;
+	}
+#endif
+	ascii_widen = widen;
+	ascii_narrow = narrow;
+	utf8_scan = scan;
+}
+
+static int widen_init(unsigned short *out, const unsigned char *src, int len)
+{
+	ascii_dispatch();
+	return ascii_widen(out, src, len);
+}
+
+static int narrow_init(unsigned char *out, const unsigned short *src, int len)
+{
+	ascii_dispatch();
+	return ascii_narrow(out, src, len);
+}
+
+static int validate_init(const unsigned char *src, int len)
+{
+	ascii_dispatch();
+	return utf8_scan ? utf8_scan(src, len) : 0;
+}
+
 int utf8towcs(unsigned short *out, const unsigned char *src, int srcbytes)
 {
 	uint32_t byte;
 	uint32_t codep = 0;
 	uint32_t state = 0;
 	int i = 0;
-	const unsigned char *max = srcbytes < 0 ? (const unsigned char *)UINTPTR_MAX : src + srcbytes;
+	if (srcbytes < 0)
+		srcbytes = (int)strlen((const char *)src) + 1; // including '\0'
+	const unsigned char *max = src + srcbytes;
 	if (out == NULL) {
 		while (src < max) {
+			if (state == UTF8_ACCEPT && *src < 0x80) {
+				int n = ascii_widen(NULL, src, (int)(max - src));
+				src += n;
+				i += n;
+				continue;
+			}
 			byte = *src++;
 			decode(&state, &codep, byte);
 			if (state == UTF8_ACCEPT) {
@@ -54,8 +386,6 @@ int utf8towcs(unsigned short *out, const unsigned char *src, int srcbytes)
 				} else {
 					i += 2;
 				}
-				if (!byte && srcbytes < 0)
-					break;
 			} else if (state == UTF8_REJECT) {
 				break; // ERROR
 			}
@@ -63,6 +393,12 @@ int utf8towcs(unsigned short *out, const unsigned char *src, int srcbytes)
 		return i;
 	}
 	while (src < max) {
+		if (state == UTF8_ACCEPT && *src < 0x80) {
+			int n = ascii_widen(out + i, src, (int)(max - src));
+			src += n;
+			i += n;
+			continue;
+		}
 		byte = *src++;
 		decode(&state, &codep, byte);
 		if (state == UTF8_ACCEPT) {
@@ -72,8 +408,6 @@ int utf8towcs(unsigned short *out, const unsigned char *src, int srcbytes)
 				out[i++] = (unsigned short)(0xD7C0 + (codep >> 10));
 				out[i++] = (unsigned short)(0xDC00 + (codep & 0x3FF));
 			}
-			if (!byte && srcbytes < 0)
-				break;
 		} else if (state == UTF8_REJECT) {
 			break; // ERROR
 		}
@@ -85,15 +419,23 @@ int wcstoutf8(unsigned char *out, const unsigned short *src, int srclen)
 {
 	unsigned int c = 0;
 	int i = 0;
-	const unsigned short *max = srclen < 0 ? (const unsigned short *)UINTPTR_MAX : src + srclen;
+	if (srclen < 0) {
+		const unsigned short *end = src;
+		while (*end++) {
+		}
+		srclen = (int)(end - src); // including '\0'
+	}
+	const unsigned short *max = src + srclen;
 	if (out == NULL) {
 		while (src < max) {
+			if (*src < 0x80) {
+				int n = ascii_narrow(NULL, src, (int)(max - src));
+				src += n;
+				i += n;
+				continue;
+			}
 			c = *src++;
-			if (c < 0x80) {
-				i++;
-				if (!c && srclen < 0)
-					break;
-			} else if (c < 0x800) {
+			if (c < 0x800) {
 				i += 2;
 			} else if (c >= 0xD800 && c <= 0xDFFF) { // surrogate pair
 				if (++src == max)
@@ -106,12 +448,14 @@ int wcstoutf8(unsigned char *out, const unsigned short *src, int srclen)
 		return i;
 	}
 	while (src < max) {
+		if (*src < 0x80) {
+			int n = ascii_narrow(out + i, src, (int)(max - src));
+			src += n;
+			i += n;
+			continue;
+		}
 		c = *src++;
-		if (c < 0x80) {
-			out[i++] = (unsigned char)c;
-			if (!c && srclen < 0)
-				break;
-		} else if (c < 0x800) {
+		if (c < 0x800) {
 			out[i++] = (unsigned char)(0xC0 | (c >> 6));
 			out[i++] = (unsigned char)(0x80 | (c & 63));
 		} else if (c >= 0xD800 && c <= 0xDFFF) {
@@ -130,3 +474,121 @@ int wcstoutf8(unsigned char *out, const unsigned short *src, int srclen)
 	}
 	return i;
 }
+
+int utf8_decoder_feed(struct utf8_decoder *dec, unsigned short *out, const unsigned char *src, int srcbytes)
+{
+	int i = 0;
+	uint32_t state = dec->state;
+	uint32_t codep = dec->codep;
+	const unsigned char *max = src + srcbytes;
+	while (src < max && state != UTF8_REJECT) {
+		if (state == UTF8_ACCEPT && *src < 0x80) {
+			int n = ascii_widen(out + i, src, (int)(max - src));
+			src += n;
+			i += n;
+			continue;
+		}
+		decode(&state, &codep, *src++);
+		if (state == UTF8_ACCEPT) {
+			if (codep < 0xFFFF) {
+				out[i++] = (unsigned short)codep;
+			} else {
+				out[i++] = (unsigned short)(0xD7C0 + (codep >> 10));
+				out[i++] = (unsigned short)(0xDC00 + (codep & 0x3FF));
+			}
+		}
+	}
+	dec->state = state;
+	dec->codep = codep;
+	return i;
+}
+
+int utf8_encoder_flush(struct utf8_encoder *enc, unsigned char *out)
+{
+	if (!enc->high)
+		return 0;
+	out[0] = (unsigned char)(0xE0 | (enc->high >> 12));
+	out[1] = (unsigned char)(0x80 | ((enc->high >> 6) & 63));
+	out[2] = (unsigned char)(0x80 | (enc->high & 63));
+	enc->high = 0;
+	return 3;
+}
+
+int utf8_encoder_feed(struct utf8_encoder *enc, unsigned char *out, const unsigned short *src, int srclen)
+{
+	unsigned int c;
+	int i = 0;
+	const unsigned short *max = src + srclen;
+	while (src < max) {
+		if (!enc->high && *src < 0x80) {
+			int n = ascii_narrow(out + i, src, (int)(max - src));
+			src += n;
+			i += n;
+			continue;
+		}
+		c = *src++;
+		if (enc->high) {
+			if (c >= 0xDC00 && c <= 0xDFFF) {
+				int k = ((((int)enc->high - 0xD800) << 10) | ((int)c - 0xDC00)) + 0x10000;
+				enc->high = 0;
+				out[i++] = (unsigned char)(0xF0 | (k >> 18));
+				out[i++] = (unsigned char)(0x80 | ((k >> 12) & 63));
+				out[i++] = (unsigned char)(0x80 | ((k >> 6) & 63));
+				out[i++] = (unsigned char)(0x80 | (k & 63));
+				continue;
+			}
+			// unpaired high surrogate, outputs it as is
+			i += utf8_encoder_flush(enc, out + i);
+		}
+		if (c < 0x80) {
+			out[i++] = (unsigned char)c;
+		} else if (c < 0x800) {
+			out[i++] = (unsigned char)(0xC0 | (c >> 6));
+			out[i++] = (unsigned char)(0x80 | (c & 63));
+		} else if (c >= 0xD800 && c <= 0xDBFF) {
+			enc->high = c;
+		} else {
+			out[i++] = (unsigned char)(0xE0 | (c >> 12));
+			out[i++] = (unsigned char)(0x80 | ((c >> 6) & 63));
+			out[i++] = (unsigned char)(0x80 | (c & 63));
+		}
+	}
+	return i;
+}
+
+// returns the start offset of the first invalid sequence, or -1
+static int validate_scalar(const unsigned char *src, int i, int len)
+{
+	uint32_t codep = 0;
+	uint32_t state = UTF8_ACCEPT;
+	int start = i;
+	while (i < len) {
+		if (state == UTF8_ACCEPT) {
+			i += ascii_widen(NULL, src + i, len - i);
+			if (i == len)
+				break;
+			start = i;
+		}
+		decode(&state, &codep, src[i++]);
+		if (state == UTF8_REJECT)
+			return start;
+	}
+	return state == UTF8_ACCEPT ? -1 : start;
+}
+
+bool utf8_validate(const unsigned char *src, int len, int *err_offset)
+{
+	if (len < 0)
+		len = (int)strlen((const char *)src);
+	int i = utf8_scan ? utf8_scan(src, len) : 0;
+	// backs up to the lead byte of the sequence which crosses "i"
+	int p = i;
+	while (p > 0 && i - p < 4 && (src[p - 1] & 0xC0) == 0x80)
+		p--;
+	if (p > 0 && i - p < 4 && src[p - 1] >= 0xC0)
+		p--;
+	int err = validate_scalar(src, p, len);
+	if (err_offset)
+		*err_offset = err < 0 ? len : err;
+	return err < 0;
+}
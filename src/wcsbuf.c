@@ -87,6 +87,31 @@ void wcsbuf_append_string(struct wcsbuf *buf, wchar_t *string, int len)
 	wcsbuf_append_new(buf, string, len);
 }
 
+wchar_t *wcsbuf_reserve(struct wcsbuf *buf, int len)
+{
+	struct chunk *chk = chk_head(buf);
+	if (chk && chk->len - chk->pos >= len)
+		return chk_data(chk) + chk->pos;
+	while (buf->length >= (buf->csize << 2))
+		buf->csize <<= 1;
+	int size = len < buf->csize ? buf->csize : len;
+	chk = rb_malloc(sizeof(struct chunk) + size * sizeof(wchar_t));
+	if (!chk)
+		return NULL;
+	chk->len = size;
+	chk->pos = 0;
+	chk_next(chk) = chk_head(buf);
+	chk_head(buf) = chk;
+	return chk_data(chk);
+}
+
+void wcsbuf_commit(struct wcsbuf *buf, int len)
+{
+	struct chunk *chk = chk_head(buf);
+	chk->pos += len;
+	buf->length += len;
+}
+
 void wcsbuf_append_int(struct wcsbuf *buf, int i)
 {
 	wchar_t array[16];
@@ -94,6 +119,20 @@ void wcsbuf_append_int(struct wcsbuf *buf, int i)
 	wcsbuf_append_string(buf, array, len);
 }
 
+void wcsbuf_append_int64(struct wcsbuf *buf, int64_t i)
+{
+	wchar_t array[24];
+	wchar_t *ptr = array + ARRAYSIZE(array);
+	uint64_t u = i < 0 ? 0 - (uint64_t)i : (uint64_t)i;
+	do {
+		*--ptr = '0' + (int)(u % 10);
+		u /= 10;
+	} while (u);
+	if (i < 0)
+		*--ptr = '-';
+	wcsbuf_append_string(buf, ptr, (int)(array + ARRAYSIZE(array) - ptr));
+}
+
 static int trim_tail_zero(wchar_t *ptr, int len)
 {
 	int i = 0;